@@ -0,0 +1,42 @@
+; Virtual drive burst loader.
+;
+; Patched over the tape read routines when fastload=burst. The LOAD trap opens the file on
+; the virtual drive, stores the load address in $AE/$AF and jumps here. Each burst command
+; has the drive fill the $DF00 window: $DF00 holds the byte count (0 at end of file) and
+; $DF01-$DFFF the data.
+;
+
+SENDBUSCMD	= $ED8B
+WINDOW		= $DF00
+ENDADDR		= $AE
+STATUS		= $90
+
+* = $F92C
+		SEI
+NEXTBLOCK
+		LDA #$38					; burst command with attention set
+		JSR SENDBUSCMD				; drive fills the window then acknowledges
+		LDX WINDOW					; byte count
+		BEQ DONE
+		LDY #$00
+COPY
+		LDA WINDOW+1,Y
+		STA (ENDADDR),Y
+		INY
+		DEX
+		BNE COPY
+		TYA							; advance the end address by the block size
+		CLC
+		ADC ENDADDR
+		STA ENDADDR
+		BCC NEXTBLOCK
+		INC ENDADDR+1
+		JMP NEXTBLOCK
+DONE
+		LDA #$40					; end of file
+		STA STATUS
+		CLI
+		LDX ENDADDR
+		LDY ENDADDR+1
+		CLC
+		RTS
@@ -0,0 +1,5 @@
+10 V=53248:POKEV+21,255:POKEV+23,255:POKEV+29,255
+20 FORI=832TO894:POKEI,255:NEXT
+30 FORS=0TO7:POKE2040+S,13:POKEV+39+S,S+1:POKEV+S*2+1,100+S*4:NEXT
+40 FORX=0TO255:FORS=0TO7:POKEV+S*2,(X+S*8)AND255:NEXT:NEXT
+50 GOTO40
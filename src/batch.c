@@ -0,0 +1,753 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: batch.c
+Headless batch runs of many programs across all cores.
+
+	con64 --batch manifest.ini [results.jsonl]
+
+The manifest is an ini file with one section per job. The [batch] section is settings for
+the run as a whole:
+
+	[batch]
+	workers=8					; threads to run jobs on. default is one per core.
+
+	[hello]
+	program=tests/hello.prg		; PRG to load once BASIC is ready, or
+	disk=tests/games.d64		; a disk, with program= naming the file on it.
+	cart=tests/magicdesk.crt	; CRT to plug in before reset.
+	frames=600					; stop after this many frames (default 600) ...
+	cycles=2000000				; ... or this many cpu cycles, whichever is first.
+	basic=tests/hello.bas		; or a BASIC listing, tokenized into memory.
+	type=0:RUN					; at frame 0 after BASIC is ready type RUN and RETURN.
+	until=0400=08				; stop early once $0400 holds $08. until=ready stops at READY.
+	pc=0400						; start the cpu here once program is loaded.
+	hashevery=50				; record a frame hash every 50 frames.
+	ram=0400-07E7				; dump this range of ram in the results. may repeat.
+	routines=hello.csv			; profile the 6502 code: cycles per routine,
+	pcs=hello-pcs.csv			; per address,
+	folded=hello.folded			; and folded stacks for flame graphs.
+	labels=hello.lbl			; VICE or ACME labels to name routines with.
+
+con64-headless takes the same keys as options (--frames 100 --program x.prg) and runs one
+job. Each job gets its own machine, unthrottled and without a window. Jobs are dealt out to a
+queue per worker; a worker that runs out steals from the front of the others. One line of
+JSON per job goes to the results file as jobs finish: cycles and frames run, frame hashes,
+the screen as text and the requested ram.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+	Jobs with a disk take turns, the disk image layer is shared by the whole process.
+
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "emu.h"
+#include "cpu.h"
+#include "mem.h"
+#include "c64.h"
+#include "vicii.h"
+#include "sysclock.h"
+#include "cart.h"
+#include "d64.h"
+#include "fileload.h"
+#include "ini.h"
+#include "batch.h"
+
+
+#define BATCH_MAX_HASHES		64
+
+#define BATCH_BASIC_READY		0xA480		// basic warm start, the machine is at READY.
+#define BATCH_BASIC_START		0x0801
+#define BATCH_VARTAB			0x002D		// basic end of program/start of variables.
+#define BATCH_KEYBUF			0x0277		// kernal keyboard buffer.
+#define BATCH_KEYBUF_COUNT		0x00C6
+#define BATCH_KEYBUF_SIZE		10
+#define BATCH_PETSCII_RETURN	0x0D
+
+#define BATCH_SCREEN_COLUMNS	40
+#define BATCH_SCREEN_ROWS		25
+
+
+//
+// a worker's jobs. the owner takes from the back, thieves from the front.
+//
+typedef struct {
+
+	pthread_mutex_t lock;
+	int * 			jobs;
+	int 			head;
+	int 			tail;
+
+} BATCH_QUEUE;
+
+typedef struct {
+
+	BATCH_JOB * 	jobs;
+	int 			jobCount;
+	int 			workers;
+
+	BATCH_QUEUE * 	queues;
+	FILE * 			results;
+	int 			failed;
+
+} BATCH;
+
+BATCH g_batch;
+
+pthread_mutex_t g_batchresultslock 	= PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t g_batchdisklock 	= PTHREAD_MUTEX_INITIALIZER;
+
+
+//
+// the state of one job while it runs.
+//
+typedef struct {
+
+	BATCH_JOB * 	job;
+	bool 			ready;				// basic has reached READY and the program is in.
+	bool 			waiting;			// at READY, waiting on the disk to read the program ahead.
+	unsigned long 	frames;
+	unsigned long 	readyframe;
+	int 			input;				// next input to type.
+	char * 			typing;				// rest of the text being typed.
+	uint64_t 		hashes[BATCH_MAX_HASHES];
+	int 			hashCount;
+	const char * 	error;
+	bool 			untilmet;
+
+} BATCH_RUN;
+
+
+char * batch_petscii(const char * text) {
+
+	char * out = (char *) malloc(strlen(text) + 2);
+	int i;
+
+	for (i = 0; text[i]; i++) {
+		out[i] = toupper((unsigned char) text[i]);
+	}
+	out[i++] = BATCH_PETSCII_RETURN;
+	out[i] = 0;
+
+	return out;
+}
+
+void batch_initjob(BATCH_JOB * j, const char * name) {
+
+	memset(j,0,sizeof(BATCH_JOB));
+	j->name 	= strdup(name);
+	j->frames 	= BATCH_DEFAULT_FRAMES;
+}
+
+bool batch_setjob(BATCH_JOB * j, const char * name, const char * value) {
+
+#define MATCH(n) strcmp(name, n) == 0
+
+	char * p;
+
+	if (MATCH("program")) {
+		j->program = strdup(value);
+	} else if (MATCH("basic")) {
+		j->basic = strdup(value);
+	} else if (MATCH("disk")) {
+		j->disk = strdup(value);
+	} else if (MATCH("cart")) {
+		j->cart = strdup(value);
+	} else if (MATCH("frames")) {
+		j->frames = strtoul(value,NULL,10);
+	} else if (MATCH("cycles")) {
+		j->cycles = strtoul(value,NULL,10);
+	} else if (MATCH("hashevery")) {
+		j->hashevery = strtoul(value,NULL,10);
+	} else if (MATCH("type") && j->inputCount < BATCH_MAX_INPUTS && (p = strchr(value,':'))) {
+		j->inputs[j->inputCount].frame 	= strtoul(value,NULL,10);
+		j->inputs[j->inputCount].text 	= batch_petscii(p + 1);
+		j->inputCount++;
+	} else if (MATCH("ram") && j->regionCount < BATCH_MAX_REGIONS && (p = strchr(value,'-'))) {
+		j->regions[j->regionCount].low 	= strtoul(value,NULL,16);
+		j->regions[j->regionCount].high = strtoul(p + 1,NULL,16);
+		j->regionCount++;
+	} else if (MATCH("labels")) {
+		j->labels = strdup(value);
+	} else if (MATCH("routines")) {
+		j->routines = strdup(value);
+	} else if (MATCH("pcs")) {
+		j->pcs = strdup(value);
+	} else if (MATCH("folded")) {
+		j->folded = strdup(value);
+	} else if (MATCH("pc")) {
+		j->pc = strtoul(value,NULL,16);
+	} else if (MATCH("until") && !strcasecmp(value,"ready")) {
+		j->until 		= true;
+		j->untilready 	= true;
+	} else if (MATCH("until") && (p = strchr(value,'='))) {
+		j->until 		= true;
+		j->untiladdress = strtoul(value,NULL,16);
+		j->untilvalue 	= strtoul(p + 1,NULL,16);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+BATCH_JOB * batch_getjob(const char * section) {
+
+	if (g_batch.jobCount && !strcmp(g_batch.jobs[g_batch.jobCount - 1].name,section)) {
+		return &g_batch.jobs[g_batch.jobCount - 1];
+	}
+
+	g_batch.jobs = (BATCH_JOB *) realloc(g_batch.jobs,sizeof(BATCH_JOB) * (g_batch.jobCount + 1));
+	if (!g_batch.jobs) {
+		FATAL_ERROR("%s: out of memory for batch jobs.\n",emu_getname());
+	}
+
+	batch_initjob(&g_batch.jobs[g_batch.jobCount],section);
+	return &g_batch.jobs[g_batch.jobCount++];
+}
+
+static int batch_handler(void * data, const char * section, const char * name, const char * value) {
+
+	if (!strcmp(section,"batch")) {
+		if (!strcmp(name,"workers")) {
+			g_batch.workers = atoi(value);
+			return 1;
+		}
+		return 0;
+	}
+
+	return batch_setjob(batch_getjob(section),name,value);
+}
+
+
+//
+// what a KERNAL LOAD from BASIC would leave behind. basic programs also get their end 
+// of program pointers so RUN doesn't put variables on top of them.
+//
+bool batch_loadprg(BATCH_RUN * r, byte * data, unsigned long size) {
+
+	word loc;
+	int i;
+
+	if (size < PRG_MIN_SIZE) {
+		r->error = "program is too short to load";
+		return false;
+	}
+
+	loc = data[0] | (data[1] << 8);
+	mem_load_block(loc,data + 2,size - 2,MEM_TARGET_RAM);
+
+	if (loc == BATCH_BASIC_START) {
+		for (i = 0; i < 3; i++) {
+			mem_pokeword(BATCH_VARTAB + i * 2,loc + size - 2);
+		}
+	}
+
+	return true;
+}
+
+bool batch_loadfile(BATCH_RUN * r, char * path) {
+
+	FILE * f = fopen(path,"rb");
+	byte * data;
+	long size;
+	bool loaded;
+
+	if (!f) {
+		r->error = "program not found";
+		return false;
+	}
+
+	fseek(f,0,SEEK_END);
+	size = ftell(f);
+	rewind(f);
+
+	if (size <= 0 || !(data = (byte *) malloc(size))) {
+		fclose(f);
+		r->error = "program could not be read";
+		return false;
+	}
+
+	fread(data,1,size,f);
+	fclose(f);
+	loaded = batch_loadprg(r,data,size);
+	free(data);
+
+	return loaded;
+}
+
+void batch_ready(BATCH_RUN * r) {
+
+	D64_FILE f;
+
+	//
+	// the disk may still be reading ahead on the host. try again next frame.
+	//
+	if (r->job->disk && r->job->program && !d64_file_ready(r->job->program)) {
+		r->waiting = true;
+		return;
+	}
+
+	r->waiting 		= false;
+	r->ready 		= true;
+	r->readyframe 	= r->frames;
+
+	if (r->job->disk && r->job->program) {
+		if (d64_open_file(&f,r->job->program)) {
+			batch_loadprg(r,f.data,f.size);
+			d64_close_file(&f);
+		} else {
+			r->error = "program not found on disk";
+		}
+	} else if (r->job->program) {
+		batch_loadfile(r,r->job->program);
+	} else if (r->job->basic) {
+		bas_loadfile(r->job->basic);
+	}
+
+	if (r->job->pc && !r->error) {
+		cpu_setpc(r->job->pc);
+	}
+
+	if (r->job->untilready) {
+		r->untilmet = true;
+	}
+}
+
+//
+// the kernal reads keys from its buffer, so typing is just filling it whenever it's empty.
+//
+void batch_type(BATCH_RUN * r) {
+
+	BATCH_JOB * j = r->job;
+	int n;
+
+	if (!r->typing && r->input < j->inputCount && r->frames - r->readyframe >= j->inputs[r->input].frame) {
+		r->typing = j->inputs[r->input++].text;
+	}
+
+	if (!r->typing || mem_peek(BATCH_KEYBUF_COUNT)) {
+		return;
+	}
+
+	for (n = 0; n < BATCH_KEYBUF_SIZE && r->typing[n]; n++) {
+		mem_poke(BATCH_KEYBUF + n,r->typing[n]);
+	}
+	mem_poke(BATCH_KEYBUF_COUNT,n);
+
+	r->typing = r->typing[n] ? r->typing + n : NULL;
+}
+
+uint64_t batch_hashframe() {
+
+	uint32_t ** frame = vicii_getframe();
+	uint64_t h = 14695981039346656037ULL;	// fnv-1a
+	word y;
+	word x;
+
+	for (y = 0; y < vicii_getscreenheight(); y++) {
+		for (x = 0; x < vicii_getscreenwidth(); x++) {
+			h = (h ^ frame[y][x]) * 1099511628211ULL;
+		}
+	}
+	return h;
+}
+
+void batch_frame(BATCH_RUN * r) {
+
+	r->frames++;
+
+	if (r->job->hashevery && r->frames % r->job->hashevery == 0 && r->hashCount < BATCH_MAX_HASHES) {
+		r->hashes[r->hashCount++] = batch_hashframe();
+	}
+
+	if (r->waiting) {
+		batch_ready(r);
+	}
+
+	if (r->ready) {
+		batch_type(r);
+	}
+
+	if (r->job->until && !r->job->untilready && mem_nonmappable_peek(r->job->untiladdress) == r->job->untilvalue) {
+		r->untilmet = true;
+	}
+}
+
+char batch_screenchar(byte c, bool lower) {
+
+	c &= 0x7F;									// reverse video is the same character.
+
+	if (c == 0) {
+		return '@';
+	} else if (c <= 26) {
+		return (lower ? 'a' : 'A') + c - 1;
+	} else if (c < 32) {
+		return "[#]^_"[c - 27];
+	} else if (c < 64) {
+		return c;
+	} else if (lower && c >= 65 && c <= 90) {
+		return c;
+	}
+	return c == 96 ? ' ' : '.';
+}
+
+//
+// one character of a json string. names come from the job file and may hold anything.
+//
+void batch_writejsonchar(FILE * out, char ch) {
+
+	if (ch == '"' || ch == '\\') {
+		fprintf(out,"\\%c",ch);
+	} else if ((unsigned char) ch < 0x20) {
+		fprintf(out,"\\u%04x",(unsigned char) ch);
+	} else {
+		fputc(ch,out);
+	}
+}
+
+void batch_writejsonstring(FILE * out, const char * s) {
+
+	fputc('"',out);
+	while (*s) {
+		batch_writejsonchar(out,*s++);
+	}
+	fputc('"',out);
+}
+
+void batch_writescreen(FILE * out) {
+
+	byte d018 = mem_peek(0xD018);
+	word base = ((3 - (mem_peek(0xDD00) & 0x03)) << 14) | ((d018 >> 4) << 10);
+	char ch;
+	int row;
+	int col;
+
+	fprintf(out,"\"screen\":[");
+	for (row = 0; row < BATCH_SCREEN_ROWS; row++) {
+		fprintf(out,"%s\"",row ? "," : "");
+		for (col = 0; col < BATCH_SCREEN_COLUMNS; col++) {
+			ch = batch_screenchar(mem_nonmappable_peek(base + row * BATCH_SCREEN_COLUMNS + col),d018 & 0x02);
+			batch_writejsonchar(out,ch);
+		}
+		fprintf(out,"\"");
+	}
+	fprintf(out,"]");
+}
+
+void batch_writetext(FILE * out, BATCH_RUN * r) {
+
+	BATCH_JOB * j = r->job;
+	byte d018 = mem_peek(0xD018);
+	word base = ((3 - (mem_peek(0xDD00) & 0x03)) << 14) | ((d018 >> 4) << 10);
+	unsigned long a;
+	int row;
+	int col;
+	int i;
+
+	fprintf(out,"%s: %s, %lu cycles, %lu frames, frame hash %016llx\n",j->name,
+		r->error ? r->error : (j->until && !r->untilmet ? "until not met" : "ok"),
+		sysclock_getticks(),r->frames,(unsigned long long) batch_hashframe());
+
+	for (row = 0; j->screen && row < BATCH_SCREEN_ROWS; row++) {
+		for (col = 0; col < BATCH_SCREEN_COLUMNS; col++) {
+			fputc(batch_screenchar(mem_nonmappable_peek(base + row * BATCH_SCREEN_COLUMNS + col),d018 & 0x02),out);
+		}
+		fputc('\n',out);
+	}
+
+	for (i = 0; i < j->regionCount; i++) {
+		for (a = j->regions[i].low; a <= j->regions[i].high; a++) {
+			if ((a - j->regions[i].low) % 16 == 0) {
+				fprintf(out,"%s%04lX:",a == j->regions[i].low ? "" : "\n",a);
+			}
+			fprintf(out," %02X",mem_nonmappable_peek(a));
+		}
+		fputc('\n',out);
+	}
+}
+
+void batch_writejson(FILE * out, int index, BATCH_RUN * r) {
+
+	BATCH_JOB * j = r->job;
+	unsigned long a;
+	int i;
+
+	fprintf(out,"{\"job\":%d,\"name\":",index);
+	batch_writejsonstring(out,j->name);
+	fprintf(out,",\"ok\":%s",r->error ? "false" : "true");
+	if (r->error) {
+		fprintf(out,",\"error\":");
+		batch_writejsonstring(out,r->error);
+	}
+	if (j->until) {
+		fprintf(out,",\"until\":%s",r->untilmet ? "true" : "false");
+	}
+	fprintf(out,",\"cycles\":%lu,\"frames\":%lu,\"hash\":\"%016llx\",\"hashes\":[",
+		sysclock_getticks(),r->frames,(unsigned long long) batch_hashframe());
+	for (i = 0; i < r->hashCount; i++) {
+		fprintf(out,"%s\"%016llx\"",i ? "," : "",(unsigned long long) r->hashes[i]);
+	}
+	fprintf(out,"],");
+
+	batch_writescreen(out);
+
+	fprintf(out,",\"ram\":{");
+	for (i = 0; i < j->regionCount; i++) {
+		fprintf(out,"%s\"%04X\":\"",i ? "," : "",j->regions[i].low);
+		for (a = j->regions[i].low; a <= j->regions[i].high; a++) {
+			fprintf(out,"%02X",mem_nonmappable_peek(a));
+		}
+		fprintf(out,"\"");
+	}
+	fprintf(out,"}}\n");
+}
+
+void batch_writeresult(FILE * results, int index, BATCH_RUN * r) {
+
+	char * line = NULL;
+	size_t len = 0;
+	FILE * out;
+
+	if (!results || !(out = open_memstream(&line,&len))) {
+		return;
+	}
+
+	if (r->job->text) {
+		batch_writetext(out,r);
+	} else {
+		batch_writejson(out,index,r);
+	}
+	fclose(out);
+
+	//
+	// whole lines at a time, whatever order jobs finish in.
+	//
+	pthread_mutex_lock(&g_batchresultslock);
+	fwrite(line,1,len,results);
+	fflush(results);
+	pthread_mutex_unlock(&g_batchresultslock);
+
+	free(line);
+}
+
+int batch_runjob(BATCH_JOB * j, int index, FILE * results) {
+
+	BATCH_RUN r;
+	unsigned int frame;
+	struct timespec start;
+	struct timespec end;
+
+	memset(&r,0,sizeof(BATCH_RUN));
+	r.job = j;
+
+	if (j->disk) {
+		pthread_mutex_lock(&g_batchdisklock);
+	}
+
+	c64_init();
+	sysclock_setthrottle(false);
+
+	if ((j->routines || j->pcs || j->folded) && !cpu_profilestart(j->labels)) {
+		r.error = "labels could not be loaded";
+	}
+
+	if (j->cart) {
+		if (cart_load(j->cart)) {
+			c64_updatebanking();
+			cpu_setpc(mem_peekword(0xFFFC));
+		} else {
+			r.error = "cartridge could not be loaded";
+		}
+	}
+
+	if (j->disk) {
+		d64_insert_disk(j->disk);
+		if (!d64_inserted()) {
+			r.error = "disk could not be loaded";
+		}
+	}
+
+	frame = vicii_getframes();
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	while (!r.error && !r.untilmet && (!j->frames || r.frames < j->frames) && 
+		(!j->cycles || sysclock_getticks() < j->cycles)) {
+
+		c64_update();
+
+		if (!r.ready && !r.waiting && cpu_getpc() == BATCH_BASIC_READY) {
+			batch_ready(&r);
+		}
+
+		if (frame != vicii_getframes()) {
+			frame = vicii_getframes();
+			batch_frame(&r);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	j->seconds 		= (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	j->ranCycles 	= sysclock_getticks();
+	j->ranFrames 	= r.frames;
+	perf_get(&j->perf);
+
+	batch_writeresult(results,index,&r);
+	cpu_profilesave(j->routines,j->pcs,j->folded);
+
+	if (j->disk) {
+		d64_eject_disk();
+	}
+	c64_destroy();
+
+	if (j->disk) {
+		pthread_mutex_unlock(&g_batchdisklock);
+	}
+
+	if (r.error) {
+		return BATCH_FAILED;
+	}
+	return j->until && !r.untilmet ? BATCH_UNTIL_MISSED : BATCH_OK;
+}
+
+int batch_nextjob(int worker) {
+
+	BATCH_QUEUE * q;
+	int job = -1;
+	int i;
+
+	//
+	// own queue from the back first, then steal from the front of everyone else's.
+	//
+	for (i = 0; i < g_batch.workers && job < 0; i++) {
+
+		q = &g_batch.queues[(worker + i) % g_batch.workers];
+
+		pthread_mutex_lock(&q->lock);
+		if (q->head < q->tail) {
+			job = i ? q->jobs[q->head++] : q->jobs[--q->tail];
+		}
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	return job;
+}
+
+void * batch_worker(void * arg) {
+
+	int worker = (int) (long) arg;
+	int job;
+
+	while ((job = batch_nextjob(worker)) >= 0) {
+		if (batch_runjob(&g_batch.jobs[job],job,g_batch.results) == BATCH_FAILED) {
+			pthread_mutex_lock(&g_batchresultslock);
+			g_batch.failed++;
+			pthread_mutex_unlock(&g_batchresultslock);
+		}
+	}
+	return NULL;
+}
+
+int batch_run(const char * manifest, const char * results) {
+
+	EMU_CONFIGURATION * cfg = emu_getconfig();
+	pthread_t * threads;
+	BATCH_QUEUE * q;
+	int i;
+
+	memset(&g_batch,0,sizeof(BATCH));
+
+	if (ini_parse(manifest,batch_handler,&g_batch) < 0) {
+		printf("%s: could not read batch manifest %s.\n",emu_getname(),manifest);
+		return 1;
+	}
+	if (!(g_batch.results = fopen(results,"w"))) {
+		printf("%s: could not write batch results %s.\n",emu_getname(),results);
+		return 1;
+	}
+
+	if (g_batch.workers <= 0) {
+		g_batch.workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (g_batch.workers > g_batch.jobCount) {
+		g_batch.workers = g_batch.jobCount ? g_batch.jobCount : 1;
+	}
+
+	//
+	// nothing can step back through a batch job.
+	//
+	cfg->rewindframes = NULL;
+
+	g_batch.queues 	= (BATCH_QUEUE *) calloc(g_batch.workers,sizeof(BATCH_QUEUE));
+	threads 		= (pthread_t *) calloc(g_batch.workers,sizeof(pthread_t));
+	if (!g_batch.queues || !threads) {
+		FATAL_ERROR("%s: out of memory for batch workers.\n",emu_getname());
+	}
+
+	//
+	// deal the jobs out round robin.
+	//
+	for (i = 0; i < g_batch.workers; i++) {
+		q = &g_batch.queues[i];
+		pthread_mutex_init(&q->lock,NULL);
+		if (!(q->jobs = (int *) malloc(sizeof(int) * (g_batch.jobCount / g_batch.workers + 1)))) {
+			FATAL_ERROR("%s: out of memory for batch workers.\n",emu_getname());
+		}
+	}
+	for (i = 0; i < g_batch.jobCount; i++) {
+		q = &g_batch.queues[i % g_batch.workers];
+		q->jobs[q->tail++] = i;
+	}
+
+	DEBUG_PRINT("Batch: %d jobs on %d workers.\n",g_batch.jobCount,g_batch.workers);
+
+	for (i = 0; i < g_batch.workers; i++) {
+		if (pthread_create(&threads[i],NULL,batch_worker,(void *) (long) i) != 0) {
+			FATAL_ERROR("%s: could not start batch worker.\n",emu_getname());
+		}
+	}
+	for (i = 0; i < g_batch.workers; i++) {
+		pthread_join(threads[i],NULL);
+	}
+
+	fclose(g_batch.results);
+	printf("%s: %d jobs run, %d failed. Results in %s.\n",emu_getname(),g_batch.jobCount,g_batch.failed,results);
+
+	for (i = 0; i < g_batch.workers; i++) {
+		free(g_batch.queues[i].jobs);
+	}
+	free(g_batch.queues);
+	free(threads);
+
+	return g_batch.failed ? 1 : 0;
+}
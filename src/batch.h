@@ -0,0 +1,120 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: batch.h
+Headless batch runs of many programs across all cores.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "emu.h"
+#include "cpu.h"
+#include "perf.h"
+
+#define BATCH_DEFAULT_RESULTS	"results.jsonl"
+#define BATCH_DEFAULT_FRAMES	600
+#define BATCH_MAX_INPUTS		16
+#define BATCH_MAX_REGIONS		8
+
+//
+// what batch_runjob() returns, and con64-headless exits with.
+//
+#define BATCH_OK				0
+#define BATCH_FAILED			1			// a file couldn't be loaded.
+#define BATCH_UNTIL_MISSED		2			// ran out of frames/cycles before until= held.
+
+
+typedef struct {
+
+	unsigned long 	frame;			// frames after basic is ready.
+	char * 			text;			// petscii, ending in RETURN.
+
+} BATCH_INPUT;
+
+typedef struct {
+
+	word 			low;
+	word 			high;
+
+} BATCH_REGION;
+
+//
+// one program to run. the manifest keys (and con64-headless options) are set with 
+// batch_setjob(), see batch.c.
+//
+typedef struct {
+
+	char * 			name;
+	char * 			program;
+	char * 			basic;
+	char * 			disk;
+	char * 			cart;
+	unsigned long 	frames;
+	unsigned long 	cycles;
+	unsigned int 	hashevery;
+	word 			pc;				// where to start the cpu once program is loaded. 0 is unset.
+
+	bool 			until;			// stop once ram at untiladdress holds untilvalue,
+	bool 			untilready;		// or once basic is ready.
+	word 			untiladdress;
+	byte 			untilvalue;
+
+	BATCH_INPUT 	inputs[BATCH_MAX_INPUTS];
+	int 			inputCount;
+	BATCH_REGION 	regions[BATCH_MAX_REGIONS];
+	int 			regionCount;
+
+	char * 			labels;			// label file for the profiler.
+	char * 			routines;		// profiler outputs, see cpu_profilesave(). any of these
+	char * 			pcs;			// turns the profiler on.
+	char * 			folded;
+
+	bool 			text;			// write results as plain text instead of json.
+	bool 			screen;			// include the screen in plain text results.
+
+	//
+	// filled in by batch_runjob().
+	//
+	unsigned long 	ranCycles;
+	unsigned long 	ranFrames;
+	double 			seconds;		// host time spent running, not counting setup.
+	PERF 			perf;			// the machine's accounting, see perf.h.
+
+} BATCH_JOB;
+
+
+void batch_initjob(BATCH_JOB * job, const char * name);
+bool batch_setjob(BATCH_JOB * job, const char * name, const char * value);
+int batch_runjob(BATCH_JOB * job, int index, FILE * out);		// out may be NULL.
+int batch_run(const char * manifest, const char * results);
+
+#endif
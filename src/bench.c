@@ -0,0 +1,220 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-------------------------------------------------------------------------------
+MODULE: bench.c
+	con64-bench: runs a fixed set of headless scenarios and reports how fast the emulator 
+	ran them, and where the time went by subsystem (see perf.h). Built optimized with 
+	"make bench".
+
+	con64-bench [--only scenario] [--csv file] [--json file]
+
+	Each scenario is a batch job (see batch.c) run from the repository root:
+
+		boot 		cold boot until BASIC is ready.
+		basicloop	a tight FOR loop typed at READY.
+		bitmap		basic/bitmap1.bas, hires bitmap drawing.
+		sprites		basic/sprites.bas, eight expanded sprites moving over each other.
+		functional	the 6502 functional test. needs asm/functional.prg, functional.asm 
+					assembled with a two byte load address in front.
+		diskload	LOAD of functional.prg from asm/ served as the virtual drive's disk.
+
+	A scenario whose files are missing is reported as skipped. The table always goes to
+	stdout; --csv and --json also write one row/line per scenario, with the emulator version,
+	so runs can be compared between versions.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "emu.h"
+#include "batch.h"
+#include "perf.h"
+
+#define BENCH_MAX_KEYS		4
+
+typedef struct {
+
+	const char * 	name;
+	const char * 	needs;						// file the scenario can't run without.
+	const char * 	keys[BENCH_MAX_KEYS];		// batch job settings, key then value.
+
+} BENCH_SCENARIO;
+
+BENCH_SCENARIO g_benchscenarios[] = {
+
+	{"boot",		NULL,					{"until","ready","frames","600"}},
+	{"basicloop",	NULL,					{"type","0:FORI=0TO1E9:NEXT","frames","600"}},
+	{"bitmap",		"basic/bitmap1.bas",	{"basic","basic/bitmap1.bas","type","0:RUN"}},
+	{"sprites",		"basic/sprites.bas",	{"basic","basic/sprites.bas","type","0:RUN"}},
+	{"functional",	"asm/functional.prg",	{"program","asm/functional.prg","pc","0400"}},
+	{"diskload",	"asm/functional.prg",	{"disk","asm","type","0:LOAD\"FUNCTIONAL\",8,1"}},
+};
+
+#define BENCH_SCENARIOS 	(sizeof(g_benchscenarios) / sizeof(BENCH_SCENARIO))
+
+
+const char * bench_status(int rc) {
+
+	switch (rc) {
+		case BATCH_OK: 				return "ok";
+		case BATCH_UNTIL_MISSED: 	return "until missed";
+		default: 					return "failed";
+	}
+}
+
+void bench_header(FILE * csv) {
+
+	int s;
+
+	printf("%-12s %-12s %12s %8s %9s %9s %9s","scenario","status","cycles","frames","seconds","MHz","fps");
+	for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+		printf(" %8s",perf_name(s));
+	}
+	printf("\n");
+
+	if (csv) {
+		fprintf(csv,"version,scenario,status,cycles,frames,seconds,mhz,fps");
+		for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+			fprintf(csv,",%s",perf_name(s));
+		}
+		fprintf(csv,"\n");
+	}
+}
+
+//
+// subsystem times are seconds, estimated from sampled updates.
+//
+void bench_report(FILE * csv, FILE * json, BENCH_SCENARIO * b, BATCH_JOB * j, const char * status) {
+
+	double mhz 		= j->seconds > 0 ? j->ranCycles / j->seconds / 1e6 : 0;
+	double fps 		= j->seconds > 0 ? j->ranFrames / j->seconds : 0;
+	double rate 	= perf_tickspersecond();
+	int s;
+
+	printf("%-12s %-12s %12lu %8lu %9.3f %9.3f %9.1f",b->name,status,j->ranCycles,j->ranFrames,j->seconds,mhz,fps);
+	for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+		printf(" %8.3f",j->perf.ticks[s] / rate);
+	}
+	printf("\n");
+
+	if (csv) {
+		fprintf(csv,"%d.%d,%s,%s,%lu,%lu,%f,%f,%f",EMU_VERSION_MAJOR,EMU_VERSION_MINOR,
+			b->name,status,j->ranCycles,j->ranFrames,j->seconds,mhz,fps);
+		for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+			fprintf(csv,",%f",j->perf.ticks[s] / rate);
+		}
+		fprintf(csv,"\n");
+	}
+
+	if (json) {
+		fprintf(json,"{\"version\":\"%d.%d\",\"scenario\":\"%s\",\"status\":\"%s\",\"cycles\":%lu,"
+			"\"frames\":%lu,\"seconds\":%f,\"mhz\":%f,\"fps\":%f,\"subsystems\":{",
+			EMU_VERSION_MAJOR,EMU_VERSION_MINOR,b->name,status,j->ranCycles,j->ranFrames,j->seconds,mhz,fps);
+		for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+			fprintf(json,"%s\"%s\":%f",s ? "," : "",perf_name(s),j->perf.ticks[s] / rate);
+		}
+		fprintf(json,"}}\n");
+	}
+}
+
+int bench_open(FILE ** f, const char * path) {
+
+	if (!(*f = fopen(path,"w"))) {
+		printf("%s: could not write %s.\n",emu_getname(),path);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char**argv) {
+
+	const char * only = NULL;
+	FILE * csv = NULL;
+	FILE * json = NULL;
+	BENCH_SCENARIO * b;
+	BATCH_JOB job;
+	int failed = 0;
+	int rc;
+	int i;
+	int k;
+
+	emu_init();
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i],"--only") && i + 1 < argc) {
+			only = argv[++i];
+		} else if (!strcmp(argv[i],"--csv") && i + 1 < argc) {
+			failed |= bench_open(&csv,argv[++i]);
+		} else if (!strcmp(argv[i],"--json") && i + 1 < argc) {
+			failed |= bench_open(&json,argv[++i]);
+		} else {
+			printf("usage: con64-bench [--only scenario] [--csv file] [--json file]\n");
+			failed = 1;
+		}
+	}
+
+	if (!failed) {
+		bench_header(csv);
+	}
+
+	for (i = 0; !failed && i < BENCH_SCENARIOS; i++) {
+
+		b = &g_benchscenarios[i];
+		if (only && strcmp(only,b->name)) {
+			continue;
+		}
+
+		batch_initjob(&job,b->name);
+		for (k = 0; k < BENCH_MAX_KEYS && b->keys[k]; k += 2) {
+			batch_setjob(&job,b->keys[k],b->keys[k + 1]);
+		}
+
+		if (b->needs && access(b->needs,R_OK)) {
+			bench_report(csv,json,b,&job,"skipped");
+			continue;
+		}
+
+		rc = batch_runjob(&job,i,NULL);
+		bench_report(csv,json,b,&job,bench_status(rc));
+		failed |= rc == BATCH_FAILED;
+	}
+
+	if (csv) {
+		fclose(csv);
+	}
+	if (json) {
+		fclose(json);
+	}
+
+	emu_destroy();
+	return failed;
+}
@@ -43,6 +43,12 @@ KNOWN BUGS:
 #include "mem.h"
 #include "sysclock.h"
 #include "vdrive.h"
+#include "cart.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "joystick.h"
+#include "perf.h"
+#include "c64.h"
 
 
 
@@ -69,11 +75,14 @@ KNOWN BUGS:
 #define CIA2_AREA_HIGH_ADDRESS			0xDDFF
 
 
+#define IO2_AREA_LOW_ADDRESS			0xDF00
+#define IO2_AREA_HIGH_ADDRESS			0xDFFF
+
 #define VICII_AREA_LOW_ADDRESS			0xD000
 #define VICII_AREA_HIGH_ADDRESS			0xD3FF
 
 
-typedef struct {
+typedef struct _C64_MAPPED_IO {
 
 	//
 	// these hold the memory map ids from mem_map();
@@ -85,6 +94,7 @@ typedef struct {
 	byte mCia1;
 	byte mCia2;
 	byte mVicii;
+	byte mIo2;
 
 	//
 	// ROMs
@@ -93,9 +103,17 @@ typedef struct {
 	byte * rBasic;
 	byte * rChar;
 
+	//
+	// scheduling
+	//
+	word cpufree;		// cycles the CPU can still run before the VIC needs the bus.
+	unsigned int lastframe;	// last VIC frame handed to the rewind buffer.
+
 } C64_MAPPED_IO;
 
-C64_MAPPED_IO g_io;
+__thread C64 * g_c64 = NULL;
+
+#define g_io 	(*g_c64->io)
 
 
 void c64_rompoke(word address, byte val) {}
@@ -109,20 +127,23 @@ byte c64_bankswitchpeek(word address) 			{return mem_nonmappable_peek(address+1)
 void c64_bankswitchpoke(word address, byte val) {
 	
 	bool allram = false;
+	byte cart;
 
 	if ((val & 0x03) ==0) {
 		allram = true;
 	}
 	
 	//
-	// do memory mapping.
+	// do memory mapping. a cartridge can take over the basic and kernal areas.
 	//
-	mem_mapactive(g_io.mKernal,!allram && (val & 0x02));
-	mem_mapactive(g_io.mBasic, !allram && (val & 0x01));
+	cart = cart_bankswitch(val & 0x01,val & 0x02,!allram && (val & 0x04));
+	mem_mapactive(g_io.mKernal,!allram && (val & 0x02) && !(cart & CART_ROMH_E000));
+	mem_mapactive(g_io.mBasic, !allram && (val & 0x01) && !(cart & CART_ROMH_A000));
 	mem_mapactive(g_io.mChar, !allram && (val && ((val & 0x04) == 0)));
 	mem_mapactive(g_io.mCia1, !allram && (val & 0x04));
 	mem_mapactive(g_io.mCia2, !allram && (val & 0x04));
 	mem_mapactive(g_io.mVicii, !allram && (val & 0x04));
+	mem_mapactive(g_io.mIo2, !allram && (val & 0x04));
 
 
 	DEBUG_IF((mem_nonmappable_peek(address + 1) & 0x7) != (val & 0x7))
@@ -135,6 +156,13 @@ void c64_bankswitchpoke(word address, byte val) {
 	mem_nonmappable_poke(address+1,val);
 }
 
+//
+// reapply the current cpu port value, for when the cartridge lines change.
+//
+void c64_updatebanking() {
+	c64_bankswitchpoke(BANKSWITCH_ADDRESS - 1,mem_nonmappable_peek(BANKSWITCH_ADDRESS));
+}
+
 
 //
 // helper routine that reads in an asm file and writes it as a string. So that it can be added
@@ -199,7 +227,21 @@ byte * c64_init_rom(char * name) {
 }
 
 
-void c64_init() {
+void c64_loadstate(void * state, byte * data) {
+
+	//
+	// registered last, so ram and the cartridge are already back. redo the memory maps 
+	// from the restored cpu port.
+	//
+	g_io.cpufree = ((C64_MAPPED_IO *) data)->cpufree;
+	g_io.lastframe = vicii_getframes();
+	c64_updatebanking();
+}
+
+//
+// builds a new machine and binds it to the calling thread.
+//
+C64 * c64_init() {
 
 
 
@@ -208,7 +250,11 @@ void c64_init() {
 
 	DEBUG_PRINT("** Initializing computer...\n");
 
-	memset(&g_io,0,sizeof(C64_MAPPED_IO));
+	if (!(g_c64 = (C64 *) calloc(1,sizeof(C64)))) {
+		FATAL_ERROR("%s: out of memory for machine state.\n",emu_getname());
+	}
+	C64_STATE(io);
+	perf_init();								// before anything can reach a memory handler.
 	mem_init();									// init ram
 
 
@@ -225,11 +271,20 @@ void c64_init() {
 	g_io.mCia1			= mem_map(CIA1_AREA_LOW_ADDRESS,CIA1_AREA_HIGH_ADDRESS,cia1_peek,cia1_poke);
 	g_io.mCia2			= mem_map(CIA2_AREA_LOW_ADDRESS,CIA2_AREA_HIGH_ADDRESS,cia2_peek,cia2_poke);
 	g_io.mVicii			= mem_map(VICII_AREA_LOW_ADDRESS,VICII_AREA_HIGH_ADDRESS,vicii_peek,vicii_poke);
+	g_io.mIo2			= mem_map(IO2_AREA_LOW_ADDRESS,IO2_AREA_HIGH_ADDRESS,vdrive_windowpeek,vdrive_windowpoke);
 
 
 	if (!g_io.rKernal || !g_io.rBasic || !g_io.rChar) {
 		FATAL_ERROR("%s: Failed to load roms. Exiting.\n",emu_getname());
 	}
+
+	//
+	// the cartridge has to be in before the cpu fetches the reset vector.
+	//
+	cart_init();
+	if (cfg->cartload != NULL) {
+		cart_load(cfg->cartload);
+	}
 	//
 	// Bankswitching is always active. Determines which other memory locations are currently mapped. 
 	//
@@ -243,6 +298,7 @@ void c64_init() {
 	//
 	// initialize rest of system.
 	//
+	joy_init();
 	c64kbd_init();
 	sysclock_init();						// init clock
 	cpu_init();								// init 6502 CPU for C64 emulator.
@@ -250,30 +306,77 @@ void c64_init() {
 	vicii_init();
 	vdrive_init();
 
+	snapshot_register("C64 ",1,&g_io,sizeof(C64_MAPPED_IO),c64_loadstate);
+
+	//
+	// after everything has registered its state.
+	//
+	rewind_init();
+
+	return g_c64;
 }
 
+//
+// make c64 the machine this thread's calls act on.
+//
+void c64_bind(C64 * c64) {g_c64 = c64;}
+
 void c64_update() {
 
+	PERF_SAMPLE();
 	sysclock_update();
+
+	PERF_BEGIN();
 	
 	if (sysclock_getphi() == PHI_HIGH) {
 		//
 		// CPU update on high signal, unless VIC has claimed the bus.
 		//
-		cia_update();
-		vdrive_update();
-		if (!vicii_stuncpu()) {
+		if (vdrive_update()) {
+			PERF_COUNT(PERF_VDRIVE);
+		}
+		PERF_TIME(PERF_VDRIVE);
+
+		//
+		// the VIC publishes which cycles it steals per line, so only ask it again once the 
+		// current run of free cycles has been used up.
+		//
+		if (g_io.cpufree == 0) {
+			g_io.cpufree = vicii_getfreecycles();
+		}
+
+		if (g_io.cpufree) {
+			g_io.cpufree--;
 			cpu_update();
+			PERF_END(PERF_CPU);
 		}
 		else {
 			vicii_update();
+			cpu_profilestolen();
+			PERF_END(PERF_VICII);
 		}
 	} else {
 		//
 		// VIC can use the memory bus on all PHI_LOW cycles.
 		//
 		vicii_update();
+		PERF_END(PERF_VICII);
 	}	
+
+	if (g_io.lastframe != vicii_getframes()) {
+		g_io.lastframe = vicii_getframes();
+		rewind_frame();
+	}
+
+	PERF_SAMPLED();
+}
+
+void c64_bachanged() {
+
+	//
+	// the run of free cycles was worked out against the old schedule.
+	//
+	g_io.cpufree = 0;
 }
 
 void c64_destroy() {
@@ -282,10 +385,31 @@ void c64_destroy() {
 	cia_destroy(); 
 	c64kbd_destroy();
 	vicii_destroy();
+	vdrive_destroy();
+	cart_destroy();
+	rewind_destroy();
 
 	free(g_io.rKernal);
 	free(g_io.rBasic);
 	free(g_io.rChar);
+
+	free(g_c64->cpu);
+	free(g_c64->cputraps);
+	free(g_c64->memory);
+	free(g_c64->sysclock);
+	free(g_c64->cia1);
+	free(g_c64->cia2);
+	free(g_c64->vic);
+	free(g_c64->io);
+	free(g_c64->cart);
+	free(g_c64->kbd);
+	free(g_c64->joy);
+	free(g_c64->vdrive);
+	free(g_c64->d64);
+	free(g_c64->snapshot);
+	free(g_c64->perf);
+	free(g_c64);
+	g_c64 = NULL;
 }
 
 
@@ -32,15 +32,58 @@ MODULE: c64.h
 WORK ITEMS:
 
 KNOWN BUGS:
+	The disk image layer (d64.c, hostdir.c) is still shared by the whole process. Only one 
+	machine at a time should have a disk in use.
 
 */
 
 #ifndef C64_H
 #define C64_H
 
-void c64_init();
+//
+// everything one machine needs. each subsystem keeps its state behind one of these pointers
+// and reaches it through g_c64, which is bound per thread. a process can run as many machines
+// as it likes, one per thread at a time.
+//
+typedef struct _C64 {
+
+	struct cpu6502 * 		cpu;
+	struct _CPU_TRAPS * 	cputraps;
+	struct _CPU_PROFILE * 	cpuprofile;
+	struct _MEMORY * 		memory;
+	struct _SYSCLOCK * 		sysclock;
+	struct _CIA * 			cia1;
+	struct _CIA * 			cia2;
+	struct _VICII * 		vic;
+	struct _C64_MAPPED_IO * io;
+	struct _CARTRIDGE * 	cart;
+	struct _C64KBD * 		kbd;
+	struct _JOYSTICK * 		joy;
+	struct _VDRIVE * 		vdrive;
+	struct _D64_MACHINE * 	d64;
+	struct _SNAPSHOT * 		snapshot;
+	struct _REWIND * 		rewind;
+	struct _PERF * 			perf;
+
+} C64;
+
+extern __thread C64 * g_c64;
+
+//
+// subsystems allocate their part of the bound machine on first use.
+//
+#define C64_STATE(field) do {														\
+		if (!g_c64->field && !(g_c64->field = calloc(1,sizeof(*g_c64->field)))) {	\
+			FATAL_ERROR("%s: out of memory for machine state.\n",emu_getname());		\
+		}																			\
+	} while (0)
+
+C64 * c64_init();
+void c64_bind(C64 * c64);
 void c64_update();
 void c64_destroy();
+void c64_updatebanking();
+void c64_bachanged();				// the VIC's BA schedule changed part way through a line.
 void c64_patch_kernel(word len, byte * bytes);
 
 #endif
\ No newline at end of file
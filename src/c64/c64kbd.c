@@ -35,6 +35,9 @@ KNOWN BUGS:
 #include "emu.h"
 #include "cpu.h"
 #include "c64kbd.h"
+#include <pthread.h>
+#include "joystick.h"
+#include "c64.h"
 
 
 #define MAX_CHARS 256
@@ -44,10 +47,21 @@ typedef struct {
 	byte row;
 } KEYMAP;
 
+//
+// the key layout is the same for every machine.
+//
 KEYMAP g_c64KeyboardTable[MAX_CHARS] = {0};
+pthread_once_t g_c64KeyboardOnce = PTHREAD_ONCE_INIT;
 
+typedef struct _C64KBD {
 
-byte g_c64kbd[0x08];					// keyboard column matrix.
+	byte matrix[0x08];					// keyboard column matrix.
+	byte scan[0x100];					// port b result for every column select mask.
+
+} C64KBD;
+
+#define g_c64kbd 		(g_c64->kbd->matrix)
+#define g_c64kbdscan 	(g_c64->kbd->scan)
 	
 
 
@@ -56,6 +70,29 @@ byte c64kbd_getrow(byte col) {
 	return g_c64kbd[col];	
 }
 
+byte c64kbd_getscan(byte select) {
+
+	return g_c64kbdscan[select];
+}
+
+void c64kbd_buildscan() {
+
+	int i;
+	int sel;
+
+	//
+	// a column is selected when its bit in port a is low. each mask only differs from the 
+	// mask with its lowest clear bit set by that one column, so build from 0xFF down.
+	// joystick port 1 shares the port b lines.
+	//
+	g_c64kbdscan[0xFF] = joy_getport(1);
+
+	for (sel = 0xFE; sel >= 0; sel--) {
+		for (i = 0; sel & (0x01 << i); i++);
+		g_c64kbdscan[sel] = g_c64kbdscan[sel | (0x01 << i)] & g_c64kbd[i];
+	}
+}
+
 
 void c64kbd_InitChar(byte ch, byte col, byte row) {
 
@@ -70,13 +107,11 @@ void c64kbd_reset() {
 	for (i = 0; i < 8; i++) {
 		g_c64kbd[i] = 0xff;
 	}
+	c64kbd_buildscan();
 }
 
 
-void c64kbd_init() {
-
-	DEBUG_PRINT("** Initializing C64 Keyboard...\n");
-
+void c64kbd_inittable() {
 
 	c64kbd_InitChar(C64KEY_RUNSTOP,7,ROW_7); // STOP KEY NOT IMPL
 	c64kbd_InitChar('/',6,ROW_7);
@@ -151,7 +186,14 @@ void c64kbd_init() {
 	c64kbd_InitChar(C64KEY_DELETE,0,ROW_0);
 
 	c64kbd_InitChar(0xFF,0,0);
+}
+
+void c64kbd_init() {
+
+	DEBUG_PRINT("** Initializing C64 Keyboard...\n");
 
+	C64_STATE(kbd);
+	pthread_once(&g_c64KeyboardOnce,c64kbd_inittable);
 	c64kbd_reset();
 }
 
@@ -160,6 +202,7 @@ void c64kbd_init() {
 
 void c64kbd_keyup(byte ch) {
 	g_c64kbd[g_c64KeyboardTable[ch].column] |= g_c64KeyboardTable[ch].row;
+	c64kbd_buildscan();
 
 }
 void c64kbd_keydown(byte ch) {
@@ -171,6 +214,7 @@ void c64kbd_keydown(byte ch) {
 		cpu_nmi();
 	}
 	g_c64kbd[g_c64KeyboardTable[ch].column] &= (~g_c64KeyboardTable[ch].row);
+	c64kbd_buildscan();
 
 }
 
@@ -41,6 +41,8 @@ KNOWN BUGS:
 
 
 byte c64kbd_getrow(byte);
+byte c64kbd_getscan(byte select);
+void c64kbd_buildscan();
 void c64kbd_init();
 void c64kbd_destroy();
 void c64kbd_reset();
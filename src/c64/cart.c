@@ -0,0 +1,365 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: cart.c
+Cartridge (CRT image) support.
+
+Every CHIP packet in the image is kept in memory as an 8K rom bank. ROML banks show at $8000,
+ROMH banks at $A000 (or $E000 in ultimax mode), through memory maps that are switched on and
+off with the EXROM/GAME lines and the cpu port. A bank switch through $DE00 only changes which
+bank pointer the map reads from, nothing is copied.
+
+Supported banking:
+	type 0 	normal 8K/16K/ultimax cartridge, no banking.
+	type 5 	Ocean. $DE00 selects the bank.
+	type 19	Magic Desk. $DE00 selects the bank, bit 7 switches the cartridge off.
+	type 32	EasyFlash. $DE00 selects the bank, $DE02 sets EXROM/GAME.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+	BUGBUG: ultimax mode should also leave $1000-$7FFF and $A000-$CFFF unmapped.
+	BUGBUG: EasyFlash ram at $DF00 is not emulated, that page is the vdrive burst window.
+
+*/
+
+#include "emu.h"
+#include "cpu.h"
+#include "mem.h"
+#include "c64.h"
+#include "cart.h"
+#include "snapshot.h"
+
+
+#define CART_BANK_SIZE			0x2000
+#define CART_MAX_BANKS			64
+#define CART_CRT_SIGNATURE		"C64 CARTRIDGE   "
+#define CART_CHIP_SIGNATURE		"CHIP"
+#define CART_CHIP_HEADER_SIZE	0x10
+
+#define CART_ROML_LOW_ADDRESS	0x8000
+#define CART_ROML_HIGH_ADDRESS	0x9FFF
+#define CART_ROMH_LOW_ADDRESS	0xA000
+#define CART_ROMH_HIGH_ADDRESS	0xBFFF
+#define CART_ULTIMAX_LOW_ADDRESS	0xE000
+#define CART_ULTIMAX_HIGH_ADDRESS	0xFFFF
+#define CART_IO1_LOW_ADDRESS	0xDE00
+#define CART_IO1_HIGH_ADDRESS	0xDEFF
+
+#define CART_TYPE_NORMAL		0
+#define CART_TYPE_OCEAN			5
+#define CART_TYPE_MAGICDESK		19
+#define CART_TYPE_EASYFLASH		32
+
+#define CART_MAGICDESK_OFF		0x80
+#define CART_EASYFLASH_CONTROL	0x02
+#define CART_EASYFLASH_GAME		0x01
+#define CART_EASYFLASH_EXROM	0x02
+#define CART_EASYFLASH_MODE		0x04
+
+
+typedef struct _CARTRIDGE {
+
+	//
+	// image file contents. banks point into it.
+	//
+	byte * 	image;
+	word 	type;
+	bool 	loaded;
+
+	//
+	// line state. true when the line is asserted (pulled low) by the cartridge.
+	//
+	bool 	exrom;
+	bool 	game;
+
+	byte * 	roml[CART_MAX_BANKS];
+	byte * 	romh[CART_MAX_BANKS];
+	byte * 	added[2][CART_MAX_BANKS];	// banks cart_load_block filled in for missing ones.
+	byte 	bank;
+	byte * 	curroml;
+	byte * 	curromh;
+
+	//
+	// memory map ids from mem_map()
+	//
+	byte 	mRoml;
+	byte 	mRomh;
+	byte 	mUltimax;
+	byte 	mIo1;
+
+} CARTRIDGE;
+
+#define g_cart 	(*g_c64->cart)
+
+//
+// open bus for missing banks. shared by every machine and never written.
+//
+byte g_cart_empty[CART_BANK_SIZE] = {[0 ... CART_BANK_SIZE - 1] = 0xFF};
+
+
+byte cart_romlpeek(word address) 		{return g_cart.curroml[address];}
+byte cart_romhpeek(word address) 		{return g_cart.curromh[address];}
+void cart_romlpoke(word address,byte val) 	{mem_nonmappable_poke(address + CART_ROML_LOW_ADDRESS,val);}
+void cart_romhpoke(word address,byte val) 	{mem_nonmappable_poke(address + CART_ROMH_LOW_ADDRESS,val);}
+void cart_ultimaxpoke(word address,byte val) {}
+byte cart_io1peek(word address) 		{return 0xFF;}
+
+word cart_be16(byte * p) {return (p[0] << 8) | p[1];}
+uint32_t cart_be32(byte * p) {return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];}
+
+
+void cart_setbank(byte bank) {
+
+	g_cart.bank 	= bank % CART_MAX_BANKS;
+	g_cart.curroml 	= g_cart.roml[g_cart.bank];
+	g_cart.curromh 	= g_cart.romh[g_cart.bank];
+}
+
+void cart_io1poke(word address, byte val) {
+
+	bool exrom = g_cart.exrom;
+	bool game = g_cart.game;
+
+	switch (g_cart.type) {
+
+		case CART_TYPE_OCEAN:
+			cart_setbank(val & 0x3F);
+		break;
+
+		case CART_TYPE_MAGICDESK:
+			cart_setbank(val & 0x3F);
+			g_cart.exrom = !(val & CART_MAGICDESK_OFF);
+		break;
+
+		case CART_TYPE_EASYFLASH:
+			if (address == 0) {
+				cart_setbank(val & 0x3F);
+			} else if (address == CART_EASYFLASH_CONTROL) {
+				g_cart.exrom 	= (val & CART_EASYFLASH_EXROM) != 0;
+				g_cart.game 	= !(val & CART_EASYFLASH_MODE) || (val & CART_EASYFLASH_GAME);
+			}
+		break;
+	}
+
+	//
+	// the lines feed the PLA, so the whole memory configuration may change.
+	//
+	if (exrom != g_cart.exrom || game != g_cart.game) {
+		c64_updatebanking();
+	}
+}
+
+byte cart_bankswitch(bool loram, bool hiram, bool io) {
+
+	byte claims = 0;
+
+	if (g_cart.loaded) {
+		if (g_cart.exrom && g_cart.game) {
+			claims = (loram && hiram ? CART_ROML : 0) | (hiram ? CART_ROMH_A000 : 0);
+		} else if (g_cart.exrom) {
+			claims = loram && hiram ? CART_ROML : 0;
+		} else if (g_cart.game) {
+			claims = CART_ROML | CART_ROMH_E000;
+		}
+	}
+
+	mem_mapactive(g_cart.mRoml,claims & CART_ROML);
+	mem_mapactive(g_cart.mRomh,claims & CART_ROMH_A000);
+	mem_mapactive(g_cart.mUltimax,claims & CART_ROMH_E000);
+	mem_mapactive(g_cart.mIo1,g_cart.loaded && (io || (claims & CART_ROMH_E000)));
+
+	return claims;
+}
+
+bool cart_load(char * path) {
+
+	FILE * f;
+	long len;
+	byte * p;
+	byte * chip;
+	word bank;
+	word load;
+	word size;
+
+	f = fopen(path,"rb");
+	if (!f) {
+		DEBUG_PRINT("CART: failed to open %s.\n",path);
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);          
+	len = ftell(f);            
+	rewind(f);
+
+	cart_destroy();
+	g_cart.image = (byte *) malloc(len);
+	if (!g_cart.image || fread(g_cart.image,1,len,f) != len || len < 0x40 || 
+		memcmp(g_cart.image,CART_CRT_SIGNATURE,strlen(CART_CRT_SIGNATURE))) {
+		DEBUG_PRINT("CART: %s is not a CRT image.\n",path);
+		fclose(f);
+		cart_destroy();
+		c64_updatebanking();
+		return false;
+	}
+	fclose(f);
+
+	//
+	// header fields are big endian. the lines are stored as 0 for asserted.
+	//
+	p = g_cart.image;
+	g_cart.type 	= cart_be16(p + 0x16);
+	g_cart.exrom 	= p[0x18] == 0;
+	g_cart.game 	= p[0x19] == 0;
+
+	DEBUG_PRINT("CART: %.32s type %d exrom %d game %d.\n",p + 0x20,g_cart.type,p[0x18],p[0x19]);
+
+	for (chip = p + cart_be32(p + 0x10); chip + CART_CHIP_HEADER_SIZE <= p + len && 
+		!memcmp(chip,CART_CHIP_SIGNATURE,4); chip += cart_be32(chip + 4)) {
+
+		bank = cart_be16(chip + 0x0A) % CART_MAX_BANKS;
+		load = cart_be16(chip + 0x0C);
+		size = cart_be16(chip + 0x0E);
+
+		if (chip + CART_CHIP_HEADER_SIZE + size > p + len || cart_be32(chip + 4) == 0) {
+			break;
+		}
+
+		DEBUG_PRINT("CART: chip bank %d at %04X, %04X bytes.\n",bank,load,size);
+
+		//
+		// 16K chips at $8000 fill both ROML and ROMH.
+		//
+		if (load == CART_ROML_LOW_ADDRESS) {
+			g_cart.roml[bank] = chip + CART_CHIP_HEADER_SIZE;
+			if (size > CART_BANK_SIZE) {
+				g_cart.romh[bank] = chip + CART_CHIP_HEADER_SIZE + CART_BANK_SIZE;
+			}
+		} else if (load == CART_ROMH_LOW_ADDRESS || load == CART_ULTIMAX_LOW_ADDRESS) {
+			g_cart.romh[bank] = chip + CART_CHIP_HEADER_SIZE;
+		}
+	}
+
+	for (bank = 0; bank < CART_MAX_BANKS; bank++) {
+		g_cart.roml[bank] = g_cart.roml[bank] ? g_cart.roml[bank] : g_cart_empty;
+		g_cart.romh[bank] = g_cart.romh[bank] ? g_cart.romh[bank] : g_cart_empty;
+	}
+
+	g_cart.loaded = true;
+	cart_setbank(0);
+	c64_updatebanking();
+
+	return true;
+}
+
+unsigned long cart_load_block(word address, byte * data, unsigned long len) {
+
+	byte ** banks;
+	byte ** added;
+	word offset = address & (CART_BANK_SIZE - 1);
+
+	if (!g_cart.loaded) {
+		return 0;
+	}
+
+	if (address >= CART_ROML_LOW_ADDRESS && address <= CART_ROML_HIGH_ADDRESS) {
+		banks = g_cart.roml;
+		added = g_cart.added[0];
+	} else if ((address >= CART_ROMH_LOW_ADDRESS && address <= CART_ROMH_HIGH_ADDRESS) ||
+		address >= CART_ULTIMAX_LOW_ADDRESS) {
+		banks = g_cart.romh;
+		added = g_cart.added[1];
+	} else {
+		return 0;
+	}
+
+	if (len > CART_BANK_SIZE - offset) {
+		len = CART_BANK_SIZE - offset;
+	}
+
+	//
+	// a bank the image didn't have reads as open bus. give it its own copy to write to.
+	//
+	if (banks[g_cart.bank] == g_cart_empty) {
+		if (!(added[g_cart.bank] = (byte *) malloc(CART_BANK_SIZE))) {
+			return 0;
+		}
+		memset(added[g_cart.bank],0xFF,CART_BANK_SIZE);
+		banks[g_cart.bank] = added[g_cart.bank];
+	}
+
+	memcpy(banks[g_cart.bank] + offset,data,len);
+	cart_setbank(g_cart.bank);
+
+	return len;
+}
+
+void cart_loadstate(void * state, byte * data) {
+
+	CARTRIDGE * c = (CARTRIDGE *) data;
+
+	//
+	// the image itself isn't saved, just which bank and lines were selected.
+	//
+	g_cart.exrom 	= g_cart.loaded && c->exrom;
+	g_cart.game 	= g_cart.loaded && c->game;
+	cart_setbank(g_cart.loaded ? c->bank : 0);
+}
+
+void cart_init() {
+
+	DEBUG_PRINT("** Initializing cartridge port...\n");
+
+	C64_STATE(cart);
+	memset(&g_cart,0,sizeof(CARTRIDGE));
+	g_cart.mRoml 	= mem_map(CART_ROML_LOW_ADDRESS,CART_ROML_HIGH_ADDRESS,cart_romlpeek,cart_romlpoke);
+	g_cart.mRomh 	= mem_map(CART_ROMH_LOW_ADDRESS,CART_ROMH_HIGH_ADDRESS,cart_romhpeek,cart_romhpoke);
+	g_cart.mUltimax = mem_map(CART_ULTIMAX_LOW_ADDRESS,CART_ULTIMAX_HIGH_ADDRESS,cart_romhpeek,cart_ultimaxpoke);
+	g_cart.mIo1 	= mem_map(CART_IO1_LOW_ADDRESS,CART_IO1_HIGH_ADDRESS,cart_io1peek,cart_io1poke);
+	cart_destroy();
+	snapshot_register("CART",2,&g_cart,sizeof(CARTRIDGE),cart_loadstate);
+}
+
+void cart_destroy() {
+
+	int i;
+
+	for (i = 0; i < CART_MAX_BANKS; i++) {
+		free(g_cart.added[0][i]);
+		free(g_cart.added[1][i]);
+	}
+	memset(g_cart.added,0,sizeof(g_cart.added));
+
+	free(g_cart.image);
+	g_cart.image 	= NULL;
+	g_cart.loaded 	= false;
+	g_cart.exrom 	= false;
+	g_cart.game 	= false;
+	memset(g_cart.roml,0,sizeof(g_cart.roml));
+	memset(g_cart.romh,0,sizeof(g_cart.romh));
+	g_cart.curroml 	= g_cart_empty;
+	g_cart.curromh 	= g_cart_empty;
+}
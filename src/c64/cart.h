@@ -0,0 +1,59 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: cart.h
+Cartridge (CRT image) support.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef CART_H
+#define CART_H
+
+//
+// regions a cartridge can claim from the rom/ram underneath it. returned by cart_bankswitch()
+// so the c64 can unmap basic or kernal where the cartridge rom shows instead.
+//
+#define CART_ROML 			0x01		// $8000-$9FFF
+#define CART_ROMH_A000 		0x02		// $A000-$BFFF
+#define CART_ROMH_E000 		0x04		// $E000-$FFFF (ultimax)
+
+void cart_init();
+void cart_destroy();
+bool cart_load(char * path);
+byte cart_bankswitch(bool loram, bool hiram, bool io);
+
+//
+// writes into the selected bank's ROML ($8000) or ROMH ($A000/$E000) chip, up to the end
+// of the chip. returns the bytes written, 0 outside the cartridge windows or with no 
+// cartridge plugged in. see mem_load_block().
+//
+unsigned long cart_load_block(word address, byte * data, unsigned long len);
+
+#endif
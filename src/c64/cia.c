@@ -38,25 +38,57 @@ KNOWN BUGS:
 #include "emu.h"
 #include "cia.h"
 #include "sysclock.h"
+#include "c64kbd.h"
+#include "snapshot.h"
+#include "c64.h"
 
 #define CIA_ALARM 0x02 // used for TOD registers only.
 #define CIA_LATCH 0x01
 #define CIA_REAL  0x00
 
 
+#define CIA_CRB_INPUTMASK	(CIA_CRB_TIMERINPUT1 | CIA_CRB_TIMERINPUT2)
+#define CIA_CRB_CASCADE		CIA_CRB_TIMERINPUT2	// timer b counts timer a underflows.
+
+#define CIA_TOD_PAL_MAINS		50
+#define CIA_TOD_NTSC_MAINS		60
+#define CIA_TOD_DIVIDER_50HZ	5			// mains cycles per tenth with TODIN set.
+#define CIA_TOD_DIVIDER_60HZ	6
+
 typedef struct _CIA CIA;
 typedef byte (*PORTDATAHANDLER)(CIA * c);
 typedef void (*SIGNALIRQHANDLER)();
 
+//
+// timers are not decremented every cycle. instead we remember the counter value at the 
+// tick it was last loaded and derive the current value on demand. underflows are 
+// sysclock events.
+//
+typedef struct {
+
+	CIA * 			cia;		// owning chip.
+	byte 			lo;			// register indexes for this timer
+	byte 			hi;
+	byte 			cr;
+	byte 			flag;		// isr flag raised on underflow.
+	byte 			event;		// sysclock event id for underflow.
+	word 			counter;	// counter value at tick start.
+	unsigned long 	start;		// tick counter was last loaded (or frozen)
+
+} CIA_TIMER;
+
 struct _CIA {
 
 	byte regs[3][0x10];			// CIA1 internal registers. use CIA1_REGS enum to address.
-	byte isr;  					// read pulls current irq status
+	byte isr;  					// latched irq status. cleared when ICR is read.
 
-	unsigned long lticks;		// stores the value of sysclock_getticks() on last cia1_update()
+	CIA_TIMER ta;				// timer a
+	CIA_TIMER tb;				// timer b
 	bool todlatched;			// if true, registers will not update on reads until
 								// the tenths register is read. 
-	unsigned long todstart;
+	bool todstopped;			// writing hours stops the clock until tenths is written.
+	byte todevent;				// sysclock event id for the 10hz tod tick.
+	unsigned long todinterval;	// ticks between tenths of a second.
 
 	PORTDATAHANDLER bfn;		// port b data handler.
 	PORTDATAHANDLER afn;		// port a data handler
@@ -64,10 +96,8 @@ struct _CIA {
 
 };
 
-typedef word (*CLOCKHANDLER)(CIA *,byte mode);
-
-CIA g_cia1;
-CIA g_cia2;
+#define g_cia1 	(*g_c64->cia1)
+#define g_cia2 	(*g_c64->cia2)
 
 byte cia_peek(CIA *c,byte reg);
 void cia_poke(CIA *c,byte reg,byte val);
@@ -118,20 +148,10 @@ void cia_realtolatch(CIA * c,byte reg) {
 
 byte cia1_getportb(CIA * c) {
 
-	int i = 0;
-	byte val = 0xff;
-
-	for (i = 0; i < 8; i++) {
-
-		if (~cia_getreal(c,CIA_PRA) & (0x01 << i)) {
-			val &= c64kbd_getrow(i);
-		}
-	}
-
-	val &= joy_getport(1);
-
-	return val;
-
+	//
+	// keyboard and joystick 1 results are precomputed for every column select.
+	//
+	return c64kbd_getscan(cia_getreal(c,CIA_PRA));
 }
 
 byte cia2_getportb(CIA * c) {
@@ -163,13 +183,182 @@ byte cia_readtod(CIA * c,byte reg) {
    return c->todlatched ? cia_getlatched(c,reg) : cia_getreal(c,reg);
 }
 
+bool cia_timer_isclocked(CIA_TIMER * t) {
+
+	byte cr = cia_getreal(t->cia,t->cr);
+
+	if ((cr & CIA_CR_TIMERSTART) == 0) {
+		return false;
+	}
+	//
+	// only system clock counting is time based. CNT input is not implemented and 
+	// timer b cascade is counted at timer a underflow.
+	//
+	if (t->cr == CIA_CRA) {
+		return (cr & CIA_CRA_TIMERINPUT) == 0;
+	} 
+	return (cr & CIA_CRB_INPUTMASK) == 0;
+}
+
+word cia_timer_value(CIA_TIMER * t) {
+
+	if (cia_timer_isclocked(t)) {
+		return t->counter - (word) (sysclock_getticks() - t->start);
+	}
+	return t->counter;
+}
+
+word cia_timer_latch(CIA_TIMER * t) {
+	return ((word) cia_getlatched(t->cia,t->hi) << 8) | cia_getlatched(t->cia,t->lo);
+}
+
+void cia_timer_freeze(CIA_TIMER * t) {
+
+	//
+	// rebase the counter to now. call before changing anything that affects counting.
+	//
+	t->counter = cia_timer_value(t);
+	t->start = sysclock_getticks();
+}
+
+void cia_timer_schedule(CIA_TIMER * t) {
+
+	if (cia_timer_isclocked(t)) {
+		//
+		// counter counts down through zero, underflow happens on the following tick.
+		//
+		sysclock_scheduleevent(t->event,t->start + t->counter + 1);
+	} else {
+		sysclock_cancelevent(t->event);
+	}
+}
+
+void cia_timer_underflow(CIA_TIMER * t) {
+
+	CIA * c = t->cia;
+	byte cr = cia_getreal(c,t->cr);
+
+	c->isr |= t->flag; 
+	if (cia_getreal(c,CIA_ICR) & t->flag) {
+		c->irqfn();
+	}
+
+	//
+	// check to see if (and how) to signal underflow on port b bit six. 
+	//
+	if (cr & CIA_CR_PORTBSELECT) {
+
+		if (cr & CIA_CR_PORTBMODE) {
+			//
+			// BUGBUG Not Implemented
+			//
+		}
+		else {
+			//
+			// BUGBUG Not Implemented
+			//
+		}
+	}
+	//
+	// if runmode is one shot, turn timer off.  
+	// 
+	if (cr & CIA_CR_TIMERRUNMODE) {
+		cia_setreal(c,t->cr,cr & (~CIA_CR_TIMERSTART));
+	}
+
+	//
+	// reset to latch value. 
+	//
+	t->counter = cia_timer_latch(t);
+	t->start = sysclock_getticks();
+	cia_timer_schedule(t);
+
+	//
+	// timer b may be counting timer a underflows.
+	//
+	if (t == &c->ta && 
+		(cia_getreal(c,CIA_CRB) & (CIA_CR_TIMERSTART | CIA_CRB_INPUTMASK)) == (CIA_CR_TIMERSTART | CIA_CRB_CASCADE)) {
+
+		if (c->tb.counter == 0) {
+			cia_timer_underflow(&c->tb);
+		} else {
+			c->tb.counter--;
+		}
+	}
+}
+
+void cia_timerevent(void * data) {
+	cia_timer_underflow((CIA_TIMER *) data);
+}
+
+void cia_timer_setcontrol(CIA_TIMER * t,byte val) {
+
+	cia_timer_freeze(t);
+
+	//
+	// force load is a strobe and always reads back as zero.
+	//
+	cia_setreal(t->cia,t->cr,val & (~CIA_CR_FORCELATCH));
+	if (val & CIA_CR_FORCELATCH) { 
+		t->counter = cia_timer_latch(t);
+	}
+
+	cia_timer_schedule(t);
+}
+
+void cia_timer_setlatch(CIA_TIMER * t,byte reg,byte val) {
+
+	cia_setlatched(t->cia,reg,val);
+
+	//
+	// writing the high byte of a stopped timer loads the latch into the counter. the low 
+	// byte only goes to the latch.
+	//
+	if (reg == t->hi && (cia_getreal(t->cia,t->cr) & CIA_CR_TIMERSTART) == 0) {
+		t->counter = cia_timer_latch(t);
+		t->start = sysclock_getticks();
+	}
+}
+
+void cia_timer_init(CIA * c,CIA_TIMER * t,byte lo,byte hi,byte cr,byte flag) {
+
+	t->cia 		= c;
+	t->lo 		= lo;
+	t->hi 		= hi;
+	t->cr 		= cr;
+	t->flag 	= flag;
+	t->counter 	= 0;
+	t->start 	= sysclock_getticks();
+	t->event 	= sysclock_addevent(cia_timerevent,t,PERF_CIA);
+}
+
 byte cia_peek(CIA * c,byte address) {
 
 	byte val;
 
 	switch(address %0x10) {
 		case CIA_ICR: 
+			//
+			// reading acknowledges all pending irqs.
+			// BUGBUG: the monitor memory view reads through here too and will eat irqs.
+			//
 			val = c->isr;
+			if (val & cia_getreal(c,CIA_ICR)) {
+				val |= CIA_FLAG_CIAIRQ;
+			}
+			c->isr = 0;
+		break;
+		case CIA_TALO:
+			val = cia_timer_value(&c->ta) & 0xFF;
+		break;
+		case CIA_TAHI:
+			val = cia_timer_value(&c->ta) >> 8;
+		break;
+		case CIA_TBLO:
+			val = cia_timer_value(&c->tb) & 0xFF;
+		break;
+		case CIA_TBHI:
+			val = cia_timer_value(&c->tb) >> 8;
 		break;
 		case CIA_PRA:
 			val = c->afn(c);
@@ -230,6 +419,13 @@ void cia_seticr(CIA * c,byte val) {
 	DEBUG_PRINT("%-40s [%sABLED]\n","\tShift Register:",new & CIA_FLAG_SHRIRQ ? "EN":"DIS");
 	
 	cia_setreal(c,CIA_ICR,new);
+
+	//
+	// unmasking a source that has already fired raises the irq straight away.
+	//
+	if (c->isr & new) {
+		c->irqfn();
+	}
 }
 
 void cia_setport(CIA * c,CIA_REGISTERS reg, CIA_REGISTERS ddr, byte val) {
@@ -246,17 +442,116 @@ void cia_setport(CIA * c,CIA_REGISTERS reg, CIA_REGISTERS ddr, byte val) {
 	cia_setreal(c,reg,new);
 }
 
+void cia_checktodalarm(CIA * c) {
+
+	if (c->regs[CIA_REAL][CIA_TODHRS] 		== c->regs[CIA_ALARM][CIA_TODHRS] && 
+		c->regs[CIA_REAL][CIA_TODMINS] 		== c->regs[CIA_ALARM][CIA_TODMINS] &&
+		c->regs[CIA_REAL][CIA_TODSECS] 		== c->regs[CIA_ALARM][CIA_TODSECS] &&
+		c->regs[CIA_REAL][CIA_TODTENTHS] 	== c->regs[CIA_ALARM][CIA_TODTENTHS]) {
+		//
+		// hit alarm
+		//
+		c->isr |= CIA_FLAG_TODIRQ; 
+		if (cia_getreal(c,CIA_ICR) & CIA_FLAG_TODIRQ) {
+			c->irqfn();
+		}
+	}
+}
+
+byte cia_bcdinc(byte val) {
+
+	val++;
+	if ((val & 0x0F) == 0x0A) {
+		val = (val & 0xF0) + 0x10;
+	}
+	return val;
+}
+
+void cia_settodinterval(CIA * c) {
+
+	unsigned long mains 	= sysclock_isPALfrequency() ? CIA_TOD_PAL_MAINS : CIA_TOD_NTSC_MAINS;
+	unsigned long divider 	= (cia_getreal(c,CIA_CRA) & CIA_CRA_TODFREQUENCY) ? CIA_TOD_DIVIDER_50HZ : CIA_TOD_DIVIDER_60HZ;
+
+	//
+	// tod counts tenths by dividing the mains frequency by 5 or 6, as TODIN says. the mains
+	// follows the video standard, so a TODIN that doesn't match it runs the clock fast or slow
+	// like on the real machine.
+	//
+	c->todinterval = sysclock_gettickspersec() * divider / mains;
+}
+
+void cia_todtick(void * data) {
+
+	CIA * c = (CIA *) data;
+	byte hrs;
+	byte pm;
+
+	//
+	// advance the BCD clock by a tenth of a second, carrying through the other registers.
+	//
+	sysclock_scheduleevent(c->todevent,sysclock_getticks() + c->todinterval);
+
+	c->regs[CIA_REAL][CIA_TODTENTHS] = cia_bcdinc(c->regs[CIA_REAL][CIA_TODTENTHS]);
+	if (c->regs[CIA_REAL][CIA_TODTENTHS] == 0x10) {
+		c->regs[CIA_REAL][CIA_TODTENTHS] = 0;
+		c->regs[CIA_REAL][CIA_TODSECS] = cia_bcdinc(c->regs[CIA_REAL][CIA_TODSECS]);
+		if (c->regs[CIA_REAL][CIA_TODSECS] == 0x60) {
+			c->regs[CIA_REAL][CIA_TODSECS] = 0;
+			c->regs[CIA_REAL][CIA_TODMINS] = cia_bcdinc(c->regs[CIA_REAL][CIA_TODMINS]);
+			if (c->regs[CIA_REAL][CIA_TODMINS] == 0x60) {
+				c->regs[CIA_REAL][CIA_TODMINS] = 0;
+				//
+				// hours run 12,1..11 and am/pm flips going from 11 to 12.
+				//
+				hrs = c->regs[CIA_REAL][CIA_TODHRS] & 0x1F;
+				pm  = c->regs[CIA_REAL][CIA_TODHRS] & BIT_7;
+				if (hrs == 0x11) {
+					hrs = 0x12;
+					pm ^= BIT_7;
+				} else if (hrs == 0x12) {
+					hrs = 0x01;
+				} else {
+					hrs = cia_bcdinc(hrs);
+				}
+				c->regs[CIA_REAL][CIA_TODHRS] = pm | hrs;
+			}
+		}
+	}
+
+	cia_checktodalarm(c);
+}
+
 void cia_settod_reg(CIA * c,byte reg,byte val) {
 
+	byte where = cia_getreal(c,CIA_CRB) & CIA_CRB_TODALARMORCLOCK ? CIA_ALARM : CIA_REAL;
+
+	//
+	// values are written as BCD. mask off bits that don't exist in each register.
+	//
+	switch (reg) {
+		case CIA_TODTENTHS: val &= 0x0F; break;
+		case CIA_TODSECS: 	val &= 0x7F; break;
+		case CIA_TODMINS: 	val &= 0x7F; break;
+		case CIA_TODHRS: 	val &= 0x9F; break;
+		default: break;
+	}
 
-	byte pm = val & BIT_7;
-	val &= (~BIT_7);
+	c->regs[where][reg] = val;
 
-	byte where = cia_getreal(c,CIA_CRB) & CIA_CRB_TODALARMORCLOCK ? CIA_REAL : CIA_ALARM;
-	byte hi = (val / 10) << 4;
-	byte low = (val % 10);
+	if (where == CIA_REAL) {
+		//
+		// writing hours stops the clock, writing tenths starts it again.
+		//
+		if (reg == CIA_TODHRS) {
+			c->todstopped = true;
+			sysclock_cancelevent(c->todevent);
+		} else if (reg == CIA_TODTENTHS && c->todstopped) {
+			c->todstopped = false;
+			sysclock_scheduleevent(c->todevent,sysclock_getticks() + c->todinterval);
+		}
+	}
 
-	c->regs[where][reg] = pm | hi | low;
+	cia_checktodalarm(c);
 }
 
 void cia_poke(CIA * c,byte address,byte val) {
@@ -274,9 +569,11 @@ void cia_poke(CIA * c,byte address,byte val) {
 		//
 		// timers sets. 
 		//
-		case CIA_TALO: case CIA_TAHI: case CIA_TBLO: case CIA_TBHI:		 
-			cia_setreal(c,reg,val);
-			cia_setlatched(c,reg,val);			
+		case CIA_TALO: case CIA_TAHI:	 
+			cia_timer_setlatch(&c->ta,reg,val);			
+		break;
+		case CIA_TBLO: case CIA_TBHI:	 
+			cia_timer_setlatch(&c->tb,reg,val);			
 		break;
 		//
 		// tod sets.
@@ -288,29 +585,38 @@ void cia_poke(CIA * c,byte address,byte val) {
 			cia_seticr(c,val);
 		break;
 		case CIA_CRA:			// Timer A control register 
-			cia_setreal(c,reg,val);
-			// force load startlatch into current 
-			if (val & CIA_CR_FORCELATCH) { 
-				cia_latchtoreal(c,CIA_TALO);
-				cia_latchtoreal(c,CIA_TAHI);
-			}		
+			cia_timer_setcontrol(&c->ta,val);
+			cia_settodinterval(c);
 		break;
 		case CIA_CRB:			// Timer B control register 
-			cia_setreal(c,reg,val);
-			// force load startlatch into current 
-			if (val & CIA_CR_FORCELATCH) { 
-				cia_latchtoreal(c,CIA_TBLO);
-				cia_latchtoreal(c,CIA_TBHI);
-			}	
+			cia_timer_setcontrol(&c->tb,val);
 		break;
 		default: cia_setreal(c,reg,val);
 		break;
 	}	
 }
 
+void cia_loadstate(void * state, byte * data) {
+
+	CIA * c = (CIA *) state;
+	CIA saved = *c;
+
+	//
+	// keep the connections to the rest of the machine.
+	//
+	memcpy(c,data,sizeof(CIA));
+	c->ta.cia 	= c;
+	c->tb.cia 	= c;
+	c->afn 		= saved.afn;
+	c->bfn 		= saved.bfn;
+	c->irqfn 	= saved.irqfn;
+}
+
 void cia_init() {
 
 	DEBUG_PRINT("** Initializing CIA Chips...\n");
+	C64_STATE(cia1);
+	C64_STATE(cia2);
 	memset(&g_cia1,0,sizeof(CIA));
 	memset(&g_cia2,0,sizeof(CIA));
 	//
@@ -327,11 +633,17 @@ void cia_init() {
 	cia_setreal(&g_cia2,CIA_DDRA,0x3F);
 	cia_setreal(&g_cia2,CIA_DDRB,0x0);
 	
-	g_cia1.lticks = 0;
-	g_cia1.todstart = sysclock_getticks();
-
-	g_cia2.lticks = 0;
-	g_cia2.todstart = sysclock_getticks();
+	cia_timer_init(&g_cia1,&g_cia1.ta,CIA_TALO,CIA_TAHI,CIA_CRA,CIA_FLAG_TAUIRQ);
+	cia_timer_init(&g_cia1,&g_cia1.tb,CIA_TBLO,CIA_TBHI,CIA_CRB,CIA_FLAG_TBUIRQ);
+	cia_timer_init(&g_cia2,&g_cia2.ta,CIA_TALO,CIA_TAHI,CIA_CRA,CIA_FLAG_TAUIRQ);
+	cia_timer_init(&g_cia2,&g_cia2.tb,CIA_TBLO,CIA_TBHI,CIA_CRB,CIA_FLAG_TBUIRQ);
+
+	cia_settodinterval(&g_cia1);
+	cia_settodinterval(&g_cia2);
+	g_cia1.todevent = sysclock_addevent(cia_todtick,&g_cia1,PERF_CIA);
+	g_cia2.todevent = sysclock_addevent(cia_todtick,&g_cia2,PERF_CIA);
+	sysclock_scheduleevent(g_cia1.todevent,sysclock_getticks() + g_cia1.todinterval);
+	sysclock_scheduleevent(g_cia2.todevent,sysclock_getticks() + g_cia2.todinterval);
 
 	//
 	// connect the cia chips to other components
@@ -343,189 +655,11 @@ void cia_init() {
 
 	g_cia1.irqfn = cpu_irq;
 	g_cia2.irqfn = cpu_nmi;
-}
-
-void cia_destroy() {
-	
-}
-
-word cia_timera_clicks(CIA * c,byte mode) {
-
-	if (mode & CIA_CRA_TIMERINPUT) {
-		// BUGBUG: Not implemented. Should count down on  CNT presses here. 
-	} else {
-		return sysclock_getticks() - c->lticks;
-	}
-	return 0;
-}
-
-word cia_timerb_clicks(CIA * c,byte mode) {
 
-	switch(mode & (CIA_CRB_TIMERINPUT1 | CIA_CRB_TIMERINPUT2)) {
-
-		case 0b00000000: // sysclock ticks
-			return sysclock_getticks() - c->lticks;
-		break;
-		case 0b00100000: // CNT pin
-			// BUGBUG: Not implemented
-		break;
-		case 0b01000000: // TAU undeflow
-			return (c->isr & CIA_FLAG_TAUIRQ) ? 1 : 0;
-		break;
-		case 0b01100000: // TAU underflow + CNT pin
-			// BUGBUG: Not implemented
-		break;
-		default: break;
-	}
-	return 0;
+	snapshot_register("CIA1",1,&g_cia1,sizeof(CIA),cia_loadstate);
+	snapshot_register("CIA2",1,&g_cia2,sizeof(CIA),cia_loadstate);
 }
 
-void cia_update_timer(CIA * c,CLOCKHANDLER tickfn,byte controlreg,byte hi,byte low,byte underflowflag) {
-
-	word ticks;
-	word tval = 0;
-	word updateval= 0;
-	byte cr = cia_getreal(c,controlreg);
-
-	//
-	// is timer a enabled?
-	//
-	if ((cr & CIA_CR_TIMERSTART) == 0) {
-		//
-		// timer not running.
-		//
-		return;
-	}
-	
-	ticks = tickfn(c,cr);
-
-	tval = ((word) cia_getreal(c,hi) << 8 ) | cia_getreal(c,low);
-	updateval = tval - (ticks);
-	cia_setreal(c,hi,updateval >> 8);
-	cia_setreal(c,low,updateval & 0xFF); 
-	
-	// 
-	// check for underflow condition.
-	//
-	if (updateval > tval) { 
-		//
-		// set bit in ICS regiser. 
-		//
-		c->isr |= underflowflag; 
-		//
-		// check to see if (and how) to signal underflow on port b bit six. 
-		//
-		if (cr & CIA_CR_PORTBSELECT) {
-
-			if (cr & CIA_CR_PORTBMODE) {
-				//
-				// BUGBUG Not Implemented
-				//
-			}
-			else {
-				//
-				// BUGBUG Not Implemented
-				//
-			}
-		}
-		//
-		// if runmode is one shot, turn timer off.  
-		// 
-		if (cr & CIA_CR_TIMERRUNMODE) {
-			cia_setreal(c,controlreg,cr & (~CIA_CR_TIMERSTART));
-		}
-
-		//
-		// reset to latch value. 
-		//
-		cia_latchtoreal(c,hi);
-		cia_latchtoreal(c,low);
-	}
-}
-
-void cia_update_todreg(CIA * c,byte reg,double timeincrement,byte modval) {
-
-	unsigned long val;
-	byte high;
-	byte low;
-
-
-	//
-	// BUGBUG: May need to optimize this code. 
-	// In looking for another performance issue, I discovered that this code is generating a high amount of process time. 
-	// right now, these four lines of code are almost 2.5X times the amount of usage of the entire VICII chip and as much as
-	// 14% of overall time used in the program flow.  It doesn't apper that we are processor constrained right now, 
-	// but this is clearly too much. Best approach is probably a lookup table.
-	//
-	
-	val = (sysclock_getticks() - c->todstart) / (NTSC_TICKS_PER_SECOND * timeincrement); // total number of those increments
-	val %= modval; 	   // what flips back to zero.
-	high = (val / 10) << 4;
-	low =  val % 10; 
-	
-	//
-	// BUGBUG: am/pm!
-	//
-	cia_setreal(c,reg,high|low);
-	
-}
-
-void cia_update_timeofday(CIA * c) {
-
-
-	byte pm = c->regs[CIA_REAL][CIA_TODHRS] & BIT_7;
+void cia_destroy() {
 	
-	unsigned long nclock = sysclock_getticks();
-
-	cia_update_todreg(c,CIA_TODTENTHS,.1,10);
-	cia_update_todreg(c,CIA_TODSECS,1,60);
-	cia_update_todreg(c,CIA_TODMINS,60,60);
-	cia_update_todreg(c,CIA_TODHRS,3600,12);
-
-	if (c->regs[CIA_REAL][CIA_TODHRS] == 0) {
-		pm = pm ? 0 : BIT_7;	
-	}
-	c->regs[CIA_REAL][CIA_TODHRS] |= pm;
-
-	if (c->regs[CIA_REAL][CIA_TODHRS] == c->regs[CIA_ALARM][CIA_TODHRS] && 
-		c->regs[CIA_REAL][CIA_TODMINS] == c->regs[CIA_ALARM][CIA_TODMINS] &&
-		c->regs[CIA_REAL][CIA_TODSECS] == c->regs[CIA_ALARM][CIA_TODSECS] &&
-		c->regs[CIA_REAL][CIA_TODTENTHS] >= c->regs[CIA_ALARM][CIA_TODTENTHS]) {
-		//
-		// hit alarm
-		//
-		c->isr |= CIA_FLAG_TODIRQ; 
-	}
-}
-
-
-void cia_check_interrupts(CIA * c) {
-
-	byte icr = cia_getreal(c,CIA_ICR);
-
-	if (c->isr & icr & (CIA_FLAG_TODIRQ | CIA_FLAG_TAUIRQ | CIA_FLAG_TBUIRQ)) {
-		c->irqfn();
-	}
-}
-
-
-void cia_update_internal(CIA *c) {
-
-	//
-	// order here is important. Timerb can count timera underflows so needs to come 
-	// second.
-	//
-	c->isr = 0;
-	cia_update_timer(c,cia_timera_clicks,CIA_CRA,CIA_TAHI,CIA_TALO,CIA_FLAG_TAUIRQ);
-	cia_update_timer(c,cia_timerb_clicks,CIA_CRB,CIA_TBHI,CIA_TBLO,CIA_FLAG_TBUIRQ);
-	cia_update_timeofday(c);
-	cia_check_interrupts(c);
-
-	c->lticks = sysclock_getticks ();
-}
-
-void cia_update() {
-
-	cia_update_internal(&g_cia1);
-	cia_update_internal(&g_cia2);
 }
@@ -81,13 +81,12 @@ CIA_CRB 				=	0x0F  // Timer B control register
 #define CIA_CRA_TODFREQUENCY			0b10000000   // 1 50hz TOD, 0 60hz TOD 
 #define CIA_CRB_TIMERINPUT1				0b00100000 	 // 00 - clock cycles 01 CNT pin 
 #define CIA_CRB_TIMERINPUT2				0b01000000	 // 10 - TA underflow 11 TA underflow + CNT pin
-#define CIA_CRB_TODALARMORCLOCK			0b10000000   // 0 write to TOD registers is alarm, 1 is clock set
+#define CIA_CRB_TODALARMORCLOCK			0b10000000   // 1 write to TOD registers sets alarm, 0 sets clock
 
 
 //
 // these methods work on both cia chips on the c64.
 //
-void cia_update();
 void cia_init();
 void cia_destroy(); 
 
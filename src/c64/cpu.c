@@ -27,14 +27,22 @@ SOFTWARE.
 MODULE: cpu.c
 	6502 emulator
 
+	Also the guest profiler: per address instruction and cycle counts, routines from a label
+	file and folded call stacks for flame graphs. see cpu_profilestart().
+
 
 WORK ITEMS:
 
 KNOWN BUGS:
+	The profiler's shadow call stack isn't part of a save state. after a restore it unwinds
+	to whatever the restored stack pointer allows and carries on from there.
 
 */
 #include "emu.h"
 #include "cpu.h"
+#include <pthread.h>
+#include "snapshot.h"
+#include "c64.h"
 
 typedef struct cpu6502 {
 
@@ -48,12 +56,32 @@ typedef struct cpu6502 {
 	bool irq;					// irq signal.
 	bool nmi;					// nmi signal.
 
-	byte ucycles;				// how many cycles have we used executing? This must be 0 to execute next
+	word ucycles;				// how many cycles have we used executing? This must be 0 to execute next
 								// instruction
 
 } CPU6502;
 
 
+#define CPU_MAX_TRAPS 		8			// arbitrary
+
+typedef struct {
+
+	word 				address;		// where the trap opcode was placed.
+	byte 				op;				// opcode the trap replaced.
+	CPU_TRAPHANDLER 	fn;
+
+} CPU_TRAP;
+
+typedef struct _CPU_TRAPS {
+
+	CPU_TRAP 	traps[CPU_MAX_TRAPS];
+	byte 		trapNext;
+
+} CPU_TRAPS;
+
+#define g_cputraps 	(*g_c64->cputraps)
+
+
 typedef void (*OPHANDLER)(ENUM_AM);
 
 typedef struct {
@@ -67,8 +95,14 @@ typedef struct {
 } OPCODE;
 
 
+//
+// the opcode table is the same for every machine. it's filled in once, by whichever machine
+// starts first.
+//
 OPCODE g_opcodes[256];
-CPU6502 g_cpu;
+pthread_once_t g_opcodesonce = PTHREAD_ONCE_INIT;
+
+#define g_cpu 		(*g_c64->cpu)
 
 
 void push(byte b) {
@@ -749,6 +783,438 @@ void handle_ADC (ENUM_AM m) {
 	g_cpu.reg_a = tmp; 
 }
 
+void handle_TRAP(ENUM_AM m) {
+
+	int i;
+	word address = g_cpu.pc - 1;
+
+	for (i = 0; i < g_cputraps.trapNext; i++) {
+		if (g_cputraps.traps[i].address == address) {
+			//
+			// handler returns false to let the original instruction run.
+			//
+			if (!g_cputraps.traps[i].fn()) {
+				g_opcodes[g_cputraps.traps[i].op].fn(g_opcodes[g_cputraps.traps[i].op].am);
+				g_cpu.ucycles += g_opcodes[g_cputraps.traps[i].op].cycles;
+			}
+			return;
+		}
+	}
+
+	DEBUG_PRINT("CPU: jam opcode at %04X with no trap registered.\n",address);
+}
+
+byte cpu_addtrap(word address, byte op, CPU_TRAPHANDLER fn) {
+
+	if (g_cputraps.trapNext == CPU_MAX_TRAPS) {
+		FATAL_ERROR("CPU: Out of trap space.\n");
+	}
+
+	g_cputraps.traps[g_cputraps.trapNext].address = address;
+	g_cputraps.traps[g_cputraps.trapNext].op = op;
+	g_cputraps.traps[g_cputraps.trapNext].fn = fn;
+
+	return g_cputraps.trapNext++;
+}
+
+//
+// guest profiler. every instruction's address gets its count and the cycles it took, along 
+// with any the VIC stole while it was in flight. JSRs, BRKs and interrupts push a frame on a
+// shadow stack and the frame goes when the stack pointer climbs back above where the call 
+// left it, whichever instruction (RTS, RTI, a trap, stack games) did that. each frame is a 
+// node in a call tree that collects cycles for the folded stack output.
+//
+#define CPU_PROFILE_SIZE 			0x10000
+#define CPU_PROFILE_MAX_NODES 		65536
+#define CPU_PROFILE_MAX_DEPTH 		256
+#define CPU_PROFILE_MAX_LABELS 		16384
+#define CPU_PROFILE_LABEL_LENGTH 	32
+#define CPU_PROFILE_ROOT 			0
+#define CPU_PROFILE_NONE 			-1
+#define CPU_MAX_INSTRUCTION_LENGTH 	3
+
+typedef struct {
+
+	word 		address;
+	char 		name[CPU_PROFILE_LABEL_LENGTH];
+
+} CPU_LABEL;
+
+typedef struct {
+
+	word 		address;		// routine entry.
+	int 		parent;
+	int 		child;			// first child, the rest are linked through sibling.
+	int 		sibling;
+	uint64_t 	cycles;			// spent in this routine from this call path, not its callees.
+
+} CPU_PROFILE_NODE;
+
+typedef struct {
+
+	int 		node;
+	byte 		sp;				// stack pointer right after the call pushed its return.
+
+} CPU_PROFILE_FRAME;
+
+typedef struct _CPU_PROFILE {
+
+	uint32_t 			instructions[CPU_PROFILE_SIZE];
+	uint64_t 			cycles[CPU_PROFILE_SIZE];		// including stolen ones.
+	uint32_t 			stolen[CPU_PROFILE_SIZE];
+	byte 				entry[CPU_PROFILE_SIZE / 8];	// addresses seen as call targets.
+	word 				current;						// instruction in flight.
+
+	CPU_PROFILE_NODE 	nodes[CPU_PROFILE_MAX_NODES];
+	int 				nodeNext;
+	CPU_PROFILE_FRAME 	frames[CPU_PROFILE_MAX_DEPTH];
+	int 				depth;
+	int 				node;
+
+	CPU_LABEL * 		labels;							// sorted by address.
+	int 				labelCount;
+
+} CPU_PROFILE;
+
+#define g_cpuprofile 	(*g_c64->cpuprofile)
+
+int cpu_comparelabels(const void * a, const void * b) {
+	return (int) ((CPU_LABEL *) a)->address - (int) ((CPU_LABEL *) b)->address;
+}
+
+//
+// VICE label files ("al C:0810 .start", which ACME writes with --vicelabels) and ACME symbol
+// lists ("start = $0810 ; ?").
+//
+bool cpu_profileloadlabels(const char * path) {
+
+	FILE * f = fopen(path,"r");
+	char line[256];
+	char name[CPU_PROFILE_LABEL_LENGTH];
+	unsigned int address;
+	CPU_LABEL * l;
+
+	if (!f) {
+		DEBUG_PRINT("CPU: could not open label file %s.\n",path);
+		return false;
+	}
+
+	if (!(g_cpuprofile.labels = (CPU_LABEL *) malloc(sizeof(CPU_LABEL) * CPU_PROFILE_MAX_LABELS))) {
+		FATAL_ERROR("CPU: out of memory for profile labels.\n");
+	}
+
+	while (fgets(line,sizeof(line),f) && g_cpuprofile.labelCount < CPU_PROFILE_MAX_LABELS) {
+
+		if (sscanf(line," al C:%x .%31s",&address,name) != 2 && 
+			sscanf(line," al %x .%31s",&address,name) != 2 &&
+			sscanf(line," %31[^ \t=] = $%x",name,&address) != 2) {
+			continue;
+		}
+
+		l = &g_cpuprofile.labels[g_cpuprofile.labelCount++];
+		l->address = address;
+		strcpy(l->name,name);
+	}
+	fclose(f);
+
+	qsort(g_cpuprofile.labels,g_cpuprofile.labelCount,sizeof(CPU_LABEL),cpu_comparelabels);
+	DEBUG_PRINT("CPU: loaded %d labels from %s.\n",g_cpuprofile.labelCount,path);
+
+	return true;
+}
+
+//
+// last label at or before address, or NULL.
+//
+CPU_LABEL * cpu_profilelabel(word address) {
+
+	int low = 0;
+	int high = g_cpuprofile.labelCount - 1;
+	int mid;
+	CPU_LABEL * found = NULL;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (g_cpuprofile.labels[mid].address <= address) {
+			found = &g_cpuprofile.labels[mid];
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+//
+// a label at exactly address, or the address itself.
+//
+const char * cpu_profilename(word address, char * buf) {
+
+	CPU_LABEL * l = cpu_profilelabel(address);
+
+	if (l && l->address == address) {
+		return l->name;
+	}
+	sprintf(buf,"$%04X",address);
+	return buf;
+}
+
+bool cpu_profilestart(const char * labels) {
+
+	C64_STATE(cpuprofile);
+	free(g_cpuprofile.labels);
+	memset(&g_cpuprofile,0,sizeof(CPU_PROFILE));
+
+	g_cpuprofile.nodes[CPU_PROFILE_ROOT].parent = CPU_PROFILE_NONE;
+	g_cpuprofile.nodes[CPU_PROFILE_ROOT].child 	= CPU_PROFILE_NONE;
+	g_cpuprofile.nodeNext 	= 1;
+	g_cpuprofile.current 	= g_cpu.pc;
+
+	return !labels || cpu_profileloadlabels(labels);
+}
+
+void cpu_profilecall(word target) {
+
+	int n;
+
+	g_cpuprofile.entry[target >> 3] |= 1 << (target & 7);
+
+	if (g_cpuprofile.depth == CPU_PROFILE_MAX_DEPTH) {
+		return;
+	}
+
+	for (n = g_cpuprofile.nodes[g_cpuprofile.node].child; n != CPU_PROFILE_NONE; n = g_cpuprofile.nodes[n].sibling) {
+		if (g_cpuprofile.nodes[n].address == target) {
+			break;
+		}
+	}
+
+	//
+	// once the tree is full new call paths are charged to their caller.
+	//
+	if (n == CPU_PROFILE_NONE && g_cpuprofile.nodeNext < CPU_PROFILE_MAX_NODES) {
+		n = g_cpuprofile.nodeNext++;
+		g_cpuprofile.nodes[n].address 	= target;
+		g_cpuprofile.nodes[n].parent 	= g_cpuprofile.node;
+		g_cpuprofile.nodes[n].child 	= CPU_PROFILE_NONE;
+		g_cpuprofile.nodes[n].sibling 	= g_cpuprofile.nodes[g_cpuprofile.node].child;
+		g_cpuprofile.nodes[g_cpuprofile.node].child = n;
+	} else if (n == CPU_PROFILE_NONE) {
+		n = g_cpuprofile.node;
+	}
+
+	g_cpuprofile.frames[g_cpuprofile.depth].node 	= n;
+	g_cpuprofile.frames[g_cpuprofile.depth].sp 		= g_cpu.reg_stack;
+	g_cpuprofile.depth++;
+	g_cpuprofile.node = n;
+}
+
+void cpu_profileinstruction(byte op, byte sp) {
+
+	//
+	// stack distances are taken as signed bytes so a stack that wraps through $0100 still
+	// nests properly.
+	//
+	if ((op == 0x20 || op == 0x00) && (int8_t) (sp - g_cpu.reg_stack) > 0) {
+		cpu_profilecall(g_cpu.pc);
+	}
+
+	while (g_cpuprofile.depth && (int8_t) (g_cpu.reg_stack - g_cpuprofile.frames[g_cpuprofile.depth - 1].sp) > 0) {
+		g_cpuprofile.depth--;
+	}
+	g_cpuprofile.node = g_cpuprofile.depth ? g_cpuprofile.frames[g_cpuprofile.depth - 1].node : CPU_PROFILE_ROOT;
+}
+
+//
+// the VIC has the bus, so the instruction in flight waits.
+//
+void cpu_profilestolen() {
+
+	if (g_c64->cpuprofile) {
+		g_cpuprofile.cycles[g_cpuprofile.current]++;
+		g_cpuprofile.stolen[g_cpuprofile.current]++;
+		g_cpuprofile.nodes[g_cpuprofile.node].cycles++;
+	}
+}
+
+typedef struct {
+
+	word 		address;
+	uint32_t 	instructions;
+	uint64_t 	cycles;
+	uint32_t 	stolen;
+
+} CPU_PROFILE_ROUTINE;
+
+int cpu_compareroutines(const void * a, const void * b) {
+
+	uint64_t ca = ((CPU_PROFILE_ROUTINE *) a)->cycles;
+	uint64_t cb = ((CPU_PROFILE_ROUTINE *) b)->cycles;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+//
+// routines start at the closest label or call target at or before an address. code that has
+// neither, like a program RUN from BASIC, starts wherever its run of executed instructions does.
+//
+void cpu_profilewriteroutines(const char * path, uint64_t total) {
+
+	CPU_PROFILE_ROUTINE * r;
+	CPU_LABEL * l;
+	FILE * f;
+	char buf[8];
+	int count = 0;
+	int entry = CPU_PROFILE_NONE;
+	int block = 0;
+	int last = CPU_PROFILE_NONE;
+	int start;
+	int a;
+
+	if (!(f = fopen(path,"w"))) {
+		DEBUG_PRINT("CPU: could not write profile %s.\n",path);
+		return;
+	}
+
+	if (!(r = (CPU_PROFILE_ROUTINE *) calloc(CPU_PROFILE_SIZE,sizeof(CPU_PROFILE_ROUTINE)))) {
+		FATAL_ERROR("CPU: out of memory for the profile report.\n");
+	}
+
+	for (a = 0; a < CPU_PROFILE_SIZE; a++) {
+
+		if (g_cpuprofile.entry[a >> 3] & (1 << (a & 7))) {
+			entry = a;
+		}
+		if (!g_cpuprofile.cycles[a]) {
+			continue;
+		}
+		if (last == CPU_PROFILE_NONE || a - last > CPU_MAX_INSTRUCTION_LENGTH) {
+			block = a;
+		}
+		last = a;
+
+		l 		= cpu_profilelabel(a);
+		start 	= l && l->address > entry ? l->address : entry;
+		if (start == CPU_PROFILE_NONE) {
+			start = block;
+		}
+
+		r[start].address 		= start;
+		r[start].instructions 	+= g_cpuprofile.instructions[a];
+		r[start].cycles 		+= g_cpuprofile.cycles[a];
+		r[start].stolen 		+= g_cpuprofile.stolen[a];
+	}
+
+	for (a = 0; a < CPU_PROFILE_SIZE; a++) {
+		if (r[a].cycles) {
+			r[count++] = r[a];
+		}
+	}
+	qsort(r,count,sizeof(CPU_PROFILE_ROUTINE),cpu_compareroutines);
+
+	fprintf(f,"routine,address,instructions,cycles,stolen,percent\n");
+	for (a = 0; a < count; a++) {
+		fprintf(f,"%s,$%04X,%u,%llu,%u,%f\n",cpu_profilename(r[a].address,buf),r[a].address,
+			r[a].instructions,(unsigned long long) r[a].cycles,r[a].stolen,
+			total ? r[a].cycles * 100.0 / total : 0);
+	}
+
+	free(r);
+	fclose(f);
+}
+
+void cpu_profilewritepcs(const char * path) {
+
+	CPU_LABEL * l;
+	FILE * f;
+	int a;
+
+	if (!(f = fopen(path,"w"))) {
+		DEBUG_PRINT("CPU: could not write profile %s.\n",path);
+		return;
+	}
+
+	fprintf(f,"address,label,instructions,cycles,stolen\n");
+	for (a = 0; a < CPU_PROFILE_SIZE; a++) {
+
+		if (!g_cpuprofile.cycles[a]) {
+			continue;
+		}
+
+		fprintf(f,"$%04X,",a);
+		if ((l = cpu_profilelabel(a))) {
+			fprintf(f,a == l->address ? "%s" : "%s+%d",l->name,a - l->address);
+		}
+		fprintf(f,",%u,%llu,%u\n",g_cpuprofile.instructions[a],
+			(unsigned long long) g_cpuprofile.cycles[a],g_cpuprofile.stolen[a]);
+	}
+
+	fclose(f);
+}
+
+//
+// one line per call path, outermost first: "c64;main;$C012;CHROUT 1234". flamegraph.pl and
+// speedscope read it as is.
+//
+void cpu_profilewritefolded(const char * path) {
+
+	int chain[CPU_PROFILE_MAX_DEPTH + 1];
+	char buf[8];
+	FILE * f;
+	int depth;
+	int n;
+	int i;
+
+	if (!(f = fopen(path,"w"))) {
+		DEBUG_PRINT("CPU: could not write profile %s.\n",path);
+		return;
+	}
+
+	for (n = 0; n < g_cpuprofile.nodeNext; n++) {
+
+		if (!g_cpuprofile.nodes[n].cycles) {
+			continue;
+		}
+
+		for (depth = 0, i = n; i != CPU_PROFILE_ROOT && depth < CPU_PROFILE_MAX_DEPTH; i = g_cpuprofile.nodes[i].parent) {
+			chain[depth++] = i;
+		}
+
+		fprintf(f,"c64");
+		while (depth--) {
+			fprintf(f,";%s",cpu_profilename(g_cpuprofile.nodes[chain[depth]].address,buf));
+		}
+		fprintf(f," %llu\n",(unsigned long long) g_cpuprofile.nodes[n].cycles);
+	}
+
+	fclose(f);
+}
+
+void cpu_profilesave(const char * routines, const char * pcs, const char * folded) {
+
+	uint64_t total = 0;
+	int a;
+
+	if (!g_c64->cpuprofile) {
+		return;
+	}
+
+	for (a = 0; a < CPU_PROFILE_SIZE; a++) {
+		total += g_cpuprofile.cycles[a];
+	}
+
+	if (routines) {
+		cpu_profilewriteroutines(routines,total);
+	}
+	if (pcs) {
+		cpu_profilewritepcs(pcs);
+	}
+	if (folded) {
+		cpu_profilewritefolded(folded);
+	}
+}
+
 void cpu_checkinterrupts() {
 
 	if (g_cpu.nmi) {
@@ -769,6 +1235,10 @@ void cpu_checkinterrupts() {
 
 		g_cpu.pc = mem_peekword(VECTOR_BRK);
 		g_cpu.irq = false;
+
+		if (g_c64->cpuprofile) {
+			cpu_profilecall(g_cpu.pc);
+		}
 	
 	}
 
@@ -781,17 +1251,34 @@ bool cpu_ready() {
 void cpu_update() {
 
 	byte op;
+	byte sp;
 
 
 	if (g_cpu.ucycles == 0) {
 		cpu_checkinterrupts();
+
+		if (g_c64->cpuprofile) {
+			g_cpuprofile.current = g_cpu.pc;
+			g_cpuprofile.instructions[g_cpu.pc]++;
+		}
+
+		sp = g_cpu.reg_stack;
 		op = fetch();
 		g_opcodes[op].fn(g_opcodes[op].am);
 		g_cpu.ucycles += g_opcodes[op].cycles;
+
+		if (g_c64->cpuprofile) {
+			cpu_profileinstruction(op,sp);
+		}
 	}
 	else {
 		g_cpu.ucycles--;
 	}
+
+	if (g_c64->cpuprofile) {
+		g_cpuprofile.cycles[g_cpuprofile.current]++;
+		g_cpuprofile.nodes[g_cpuprofile.node].cycles++;
+	}
 }
 
 void setopcode(int op, char * name,ENUM_AM mode,OPHANDLER fn,byte c) {
@@ -804,19 +1291,17 @@ void setopcode(int op, char * name,ENUM_AM mode,OPHANDLER fn,byte c) {
 
 void cpu_destroy() {
 
+	if (g_c64->cpuprofile) {
+		free(g_cpuprofile.labels);
+		free(g_c64->cpuprofile);
+		g_c64->cpuprofile = NULL;
+	}
 }
 
-void cpu_init() {
+void cpu_initopcodes() {
 
 	int i = 0;
-	//
-	// clear all memory
-	//
-	memset (&g_cpu,0,sizeof(CPU6502));	
 
-	
-	DEBUG_PRINT("** Initializing 6502 CPU...\n");
-	
 	//
 	// load all opcodes
 	//
@@ -1009,6 +1494,28 @@ void cpu_init() {
 	setopcode(0x76,"ROR",AM_ZEROPAGEX,handle_ROR,6);
 	setopcode(0x6e,"ROR",AM_ABSOLUTE,handle_ROR,6);
 	setopcode(0x7e,"ROR",AM_ABSOLUTEX,handle_ROR,7);
+
+	//
+	// traps charge their own cycles. the trap opcode is a JAM on real hardware, 
+	// never used by working code.
+	//
+	setopcode(CPU_TRAP_OPCODE,"TRP",AM_IMPLICIT,handle_TRAP,0);
+}
+
+void cpu_init() {
+
+	C64_STATE(cpu);
+	C64_STATE(cputraps);
+
+	//
+	// clear all memory
+	//
+	memset (&g_cpu,0,sizeof(CPU6502));	
+	snapshot_register("CPU ",1,&g_cpu,sizeof(CPU6502),NULL);
+
+	
+	DEBUG_PRINT("** Initializing 6502 CPU...\n");
+	pthread_once(&g_opcodesonce,cpu_initopcodes);
 	
 	g_cpu.pc = mem_peekword(VECTOR_RESET);
 }
@@ -1019,10 +1526,21 @@ void cpu_nmi() {g_cpu.nmi = true;}
 byte cpu_geta() 				{return g_cpu.reg_a;}
 byte cpu_getx()					{return g_cpu.reg_x;}
 byte cpu_gety()					{return g_cpu.reg_y;}
-word cpu_getpc() 				{return g_cpu.pc;}
+//
+// debug output can come before there is a machine, or a cpu.
+//
+word cpu_getpc() 				{return g_c64 && g_c64->cpu ? g_cpu.pc : 0;}
 byte cpu_getstatus()			{return g_cpu.reg_status;}	
 byte cpu_getstack()				{return g_cpu.reg_stack;}
 
+void cpu_seta(byte val)			{g_cpu.reg_a = val;}
+void cpu_setx(byte val)			{g_cpu.reg_x = val;}
+void cpu_sety(byte val)			{g_cpu.reg_y = val;}
+void cpu_setpc(word val)		{g_cpu.pc = val;}
+void cpu_setstatus(byte val)	{g_cpu.reg_status = val;}
+void cpu_addcycles(word val)	{g_cpu.ucycles += val;}
+void cpu_rts()					{g_cpu.pc = pull_word() + 1;}
+
 
 byte cpu_disassemble(char *buf,word address) {
 
@@ -114,6 +114,14 @@ word cpu_getpc();
 byte cpu_getstatus();
 byte cpu_getstack();
 
+void cpu_seta(byte val);
+void cpu_setx(byte val);
+void cpu_sety(byte val);
+void cpu_setpc(word val);
+void cpu_setstatus(byte val);
+void cpu_addcycles(word val);	// stall the cpu for extra cycles.
+void cpu_rts();					// return from the current subroutine.
+
 //
 // action signals
 //
@@ -128,5 +136,25 @@ void cpu_nmi();  // signal nmi line
 //
 byte cpu_disassemble(char * buf,word address);
 
+//
+// traps let the emulator take over when the cpu reaches an address. the caller places
+// the trap opcode at the address (usually by patching rom) and tells us the opcode it
+// replaced. the handler returns true if it did the work, false to run the original opcode.
+//
+typedef bool (*CPU_TRAPHANDLER)(void);
+
+#define CPU_TRAP_OPCODE 	0x02
+
+byte cpu_addtrap(word address, byte op, CPU_TRAPHANDLER fn);
+
+//
+// guest profiler. cpu_profilestart() starts (or restarts) counting for the bound machine, 
+// with an optional VICE or ACME label file to name routines. cpu_profilesave() writes any of
+// a per routine csv, a per address csv and folded stacks; NULL skips one.
+//
+bool cpu_profilestart(const char * labels);
+void cpu_profilestolen();		// the VIC took a cycle from the instruction in flight.
+void cpu_profilesave(const char * routines, const char * pcs, const char * folded);
+
 
 #endif
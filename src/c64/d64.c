@@ -32,12 +32,28 @@ KNOWN BUGS:
 
 */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include "emu.h"
 #include "cpu.h"
 #include "d64.h"
+#include "sysclock.h"
+#include "hostdir.h"
+#include "c64.h"
 
 
 #define D64_BYTES_PER_SECTOR 256
+#define D64_MAX_TRACKS		 40			// 35 standard, 40 for extended images.
+#define D64_TOTAL_SECTORS	 768		// more than any chain can legally visit on a 40 track image.
+#define D64_BAM_TRACKS		 35
+#define D64_DIR_TRACK		 18
+#define D64_INTERLEAVE		 10			// same sector spacing the 1541 uses for files.
 
 
 typedef struct {
@@ -115,18 +131,53 @@ typedef struct {
 
 	D64_DIRECTORY_ENTRY entries[D64_MAX_DIRECTORY_ENTRIES];
 	byte used; 
+	byte sectors[D64_MAX_DIRECTORY_ENTRIES / 8][2];		// track/sector of each directory block.
 
 } D64_DIRECTORY;
 
 
+#define D64_NAME_LENGTH		16
+#define D64_HASH_SIZE		256
+#define D64_INDEX_NONE		-1
+#define D64_TRIE_MAX_NODES	(D64_MAX_DIRECTORY_ENTRIES * D64_NAME_LENGTH + 1)
 
+//
+// prefix trie over normalized names. children are a first-child/next-sibling list.
+// first is the lowest directory index of any name at or below this node, so a '*' 
+// can be answered without walking the subtree.
+//
 typedef struct {
 
-	FILE * 				file;  
+	byte 	ch;
+	short 	child;
+	short 	sibling;
+	short 	entry;					// directory index of the name ending here.
+	short 	first;					// lowest directory index in this subtree.
+
+} D64_TRIE_NODE;
+
+typedef struct {
+
+	char 			names[D64_MAX_DIRECTORY_ENTRIES][D64_NAME_LENGTH + 1];	// case folded, unpadded names.
+	short 			buckets[D64_HASH_SIZE];									// first entry per hash bucket.
+	short 			next[D64_MAX_DIRECTORY_ENTRIES];						// hash chains, in directory order.
+	D64_TRIE_NODE 	trie[D64_TRIE_MAX_NODES];
+	short 			nodes;
+
+} D64_INDEX;
+
+
+typedef struct {
+
+	int 				fd;  
+	byte *				image;			// mmap'ed disk image.
+	size_t 				imagesize;
 	char * 				path;
+	time_t 				mtime;			// image modification time when mapped.
 
 	D64_BAM 			bam; 
 	D64_DIRECTORY 		dir; 
+	D64_INDEX 			index;
 
 } D64_DATA;
 
@@ -134,7 +185,157 @@ typedef struct {
 
 
 
-D64_DATA g_d64 = {0};
+D64_DATA g_d64 = {-1, NULL};
+
+//
+// the machine that inserted the disk. there is one disk for the whole process.
+//
+_Atomic(C64 *) g_d64owner = NULL;
+
+
+#define D64_CACHE_DEFAULT_BUDGET	(4*1024*1024)
+
+//
+// decoded files are kept in an LRU list keyed by image, image version and directory entry
+// so repeated loads of the same program skip the sector chain walk. entries handed out
+// to callers are reference counted and are not evicted until closed.
+//
+typedef struct _D64_CACHE_ENTRY D64_CACHE_ENTRY;
+
+struct _D64_CACHE_ENTRY {
+
+	char * 				path;
+	time_t 				mtime;
+	size_t 				imagesize;
+	byte 				fTrack;				// first sector of the file identifies the entry
+	byte 				fSector;
+	char 				name[17];
+	byte * 				data;
+	unsigned long 		size;
+	int 				refs;
+	bool 				stale;				// image changed while in use. free on last close.
+	D64_CACHE_ENTRY * 	prev;
+	D64_CACHE_ENTRY * 	next;
+};
+
+typedef struct {
+
+	D64_CACHE_ENTRY * 	head;				// most recently used
+	D64_CACHE_ENTRY * 	tail;				// least recently used
+	unsigned long 		bytes;
+	unsigned long 		budget;
+	bool 				init;
+
+} D64_CACHE;
+
+D64_CACHE g_d64cache = {0};
+
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE		0		// hosts without it fault the new image in on first use.
+#endif
+
+//
+// a background thread reads sector chains ahead of time into a sector cache, so opening 
+// a file doesn't have to touch the host file (which may be slow, or on a network mount). 
+// it also looks for the image (or a host directory) changing on the host and maps the new 
+// one, or lists it again. the emulation thread only posts requests and checks flags, it 
+// never waits.
+//
+typedef struct {
+
+	pthread_t 		thread;
+	pthread_mutex_t lock;				// held by the worker while reading, and by insert/eject.
+	pthread_mutex_t waitlock;			// only held to post or wait for work, never across host I/O.
+	pthread_cond_t 	wake;
+	bool 			started;
+	atomic_bool 	quit;
+	bool 			checking;			// emulation thread: a load is waiting on a change check.
+	unsigned 		checkseq;			// change checks posted by the emulation thread.
+	atomic_uint 	checkpost;
+	atomic_uint 	checkdone;			// last check the worker finished.
+
+	//
+	// set by the worker when the image changed on the host. the new mapping waits here 
+	// until the emulation thread swaps it in.
+	//
+	atomic_bool 	stale;
+	int 			freshfd;
+	byte * 			freshimage;
+	size_t 			freshsize;
+	time_t 			freshmtime;
+
+	unsigned 		generation;			// bumped on every insert so old requests are ignored.
+	unsigned 		requested;			// last chain posted by the emulation thread.
+	atomic_uint 	pending;			// chain waiting for the worker, 0 if none.
+	atomic_uint 	done;				// last chain the worker finished.
+
+	byte 			sectors[D64_TOTAL_SECTORS][D64_BYTES_PER_SECTOR];
+	atomic_bool 	valid[D64_TOTAL_SECTORS];
+
+} D64_PREFETCH;
+
+D64_PREFETCH g_d64prefetch = {0};
+
+
+#define D64_FLUSH_IDLE_SECONDS	2			// emulated time without writes before flushing.
+#define D64_FLUSH_POLL_DIVISOR	10			// check on a background flush every 1/10 second.
+
+typedef enum {
+
+	D64_FLUSH_IDLE,
+	D64_FLUSH_QUEUED,						// snapshot waiting for the worker.
+	D64_FLUSH_DONE,							// written, waiting for the emulation thread to remap.
+	D64_FLUSH_FAILED
+
+} D64_FLUSH_STATE;
+
+//
+// writes never touch the host file directly. modified sectors live in a dirty map until 
+// they are flushed as one batch: the image is copied to a temporary file, dirty sectors 
+// are written in order and the copy is renamed over the original.
+//
+typedef struct {
+
+	byte * 			data[D64_TOTAL_SECTORS];		// dirty copy of each sector, NULL if clean.
+	unsigned 		seq[D64_TOTAL_SECTORS];			// write sequence at last modification.
+	unsigned 		writeseq;
+	int 			count;							// number of dirty sectors.
+	bool 			jobhost;						// the job is hostdir saves, not sectors.
+
+	atomic_int 		state;							// D64_FLUSH_STATE of the background job.
+	int 			jobcount;
+	int 			jobindex[D64_TOTAL_SECTORS];
+	unsigned 		jobseq[D64_TOTAL_SECTORS];
+	byte 			jobdata[D64_TOTAL_SECTORS][D64_BYTES_PER_SECTOR];
+
+} D64_JOURNAL;
+
+D64_JOURNAL g_d64journal = {0};
+
+//
+// per machine, since sysclock events belong to the machine's clock.
+//
+typedef struct _D64_MACHINE {
+
+	bool 			haveevent;
+	byte 			event;							// sysclock event for the idle flush.
+
+} D64_MACHINE;
+
+#define g_d64machine 	(*g_c64->d64)
+
+//
+// first sector index of each track (1 based). the last entry is the end of track 40.
+//
+const word g_d64trackoffset[D64_MAX_TRACKS + 2] = {
+	0,
+	0,   21,  42,  63,  84,  105, 126, 147, 168, 189,
+	210, 231, 252, 273, 294, 315, 336, 357, 376, 395,
+	414, 433, 452, 471, 490, 508, 526, 544, 562, 580,
+	598, 615, 632, 649, 666, 683, 700, 717, 734, 751,
+	768
+};
 
 
 /*
@@ -188,17 +389,43 @@ D64_DATA g_d64 = {0};
 
 void d64_track_to_sector(byte track, word * sector)  {
 
-	int i = 1;
+	(*sector) = (track >= 1 && track <= D64_MAX_TRACKS + 1) ? g_d64trackoffset[track] : 0;
+}
+
+int d64_sector_index(byte track, byte sector) {
+
+	//
+	// index of the sector in the image, or -1 if track/sector is not on the disk.
+	//
+	if (g_d64.image == NULL || track < 1 || track > D64_MAX_TRACKS || 
+		sector >= g_d64trackoffset[track + 1] - g_d64trackoffset[track] ||
+		((size_t) g_d64trackoffset[track] + sector + 1) * D64_BYTES_PER_SECTOR > g_d64.imagesize) {
+		return -1;
+	}
+
+	return g_d64trackoffset[track] + sector;
+}
+
+byte * d64_sector(byte track, byte sector) {
+
+	int i = d64_sector_index(track,sector);
 
-	(*sector) = 0;
+	if (i < 0) {
+		return NULL;
+	}
 
-	while (i < track) {
-		(*sector) += 17;
-		if (i < 31) (*sector)++;
-		if (i < 25) (*sector)++;
-		if (i < 18) (*sector)+= 2;
-		i++;
+	//
+	// unflushed writes first, then the prefetched copy, otherwise a pointer straight into 
+	// the mapped image.
+	//
+	if (g_d64journal.data[i]) {
+		return g_d64journal.data[i];
+	}
+	if (atomic_load_explicit(&g_d64prefetch.valid[i],memory_order_acquire)) {
+		return g_d64prefetch.sectors[i];
 	}
+
+	return g_d64.image + (size_t) i * D64_BYTES_PER_SECTOR;
 }
 
 void d64_sector_to_track(word sector, byte * track, word * remainder)  {
@@ -262,154 +489,1363 @@ void d64_directory(FILE * file) {
 
 
 
-void d64_seek(byte track, byte sector) {
+void d64_normalize_name(char * out, byte * name, int max) {
 
-	word s;
-	
-	d64_track_to_sector(track,&s);
-	s+=sector;
+	int i;
 
-	fseek(g_d64.file,s*256,SEEK_SET);
+	//
+	// names stop at the first $A0 pad byte. fold case so lookups from the host match.
+	//
+	for (i = 0; i < max && name[i] && name[i] != 0xA0; i++) {
+		out[i] = toupper(name[i]);
+	}
+	out[i] = 0;
 }
 
-void d64_read(void * ptr, size_t size, byte track, byte sector) {
+byte d64_hash_name(char * name) {
 
-	d64_seek(track,sector);
-	fread(ptr, size, 1, g_d64.file);
+	byte h = 0;
+
+	while (*name) {
+		h = (h << 3) ^ (h >> 5) ^ (byte) *name++;
+	}
+	return h;
 }
 
+short d64_trie_child(short node, byte ch, bool create) {
 
-bool d64_match_string(char * str1, char * str2) {
+	D64_INDEX * x = &g_d64.index;
+	short c;
 
+	for (c = x->trie[node].child; c != D64_INDEX_NONE; c = x->trie[c].sibling) {
+		if (x->trie[c].ch == ch) {
+			return c;
+		}
+	}
 
-	if (strlen(str1) != strlen(str2)) {
-		return false;
+	if (!create) {
+		return D64_INDEX_NONE;
 	}
 
-	for (int i = 0; i < strlen(str1); i++) {
-		if (toupper(str1[i]) != toupper(str2[i])) {
-			return false;
+	c = x->nodes++;
+	x->trie[c].ch 		= ch;
+	x->trie[c].child 	= D64_INDEX_NONE;
+	x->trie[c].entry 	= D64_INDEX_NONE;
+	x->trie[c].first 	= D64_INDEX_NONE;
+	x->trie[c].sibling 	= x->trie[node].child;
+	x->trie[node].child = c;
+
+	return c;
+}
+
+void d64_build_index() {
+
+	D64_INDEX * x = &g_d64.index;
+	short i;
+	short node;
+	short * tail;
+	char * p;
+	byte h;
+
+	x->nodes = 0;
+	for (i = 0; i < D64_HASH_SIZE; i++) {
+		x->buckets[i] = D64_INDEX_NONE;
+	}
+
+	x->trie[0].child 	= D64_INDEX_NONE;
+	x->trie[0].sibling 	= D64_INDEX_NONE;
+	x->trie[0].entry 	= D64_INDEX_NONE;
+	x->trie[0].first 	= D64_INDEX_NONE;
+	x->nodes 			= 1;
+
+	for (i = 0; i < g_d64.dir.used; i++) {
+
+		x->next[i] = D64_INDEX_NONE;
+		d64_normalize_name(x->names[i],g_d64.dir.entries[i].fName,D64_NAME_LENGTH);
+
+		//
+		// scratched entries are not visible.
+		//
+		if (g_d64.dir.entries[i].fType == 0) {
+			continue;
+		}
+
+		//
+		// append to the bucket chain so earlier entries win.
+		//
+		h = d64_hash_name(x->names[i]);
+		for (tail = &x->buckets[h]; *tail != D64_INDEX_NONE; tail = &x->next[*tail]);
+		*tail = i;
+
+		node = 0;
+		if (x->trie[0].first == D64_INDEX_NONE) {
+			x->trie[0].first = i;
+		}
+		for (p = x->names[i]; *p; p++) {
+			node = d64_trie_child(node,*p,true);
+			if (x->trie[node].first == D64_INDEX_NONE) {
+				x->trie[node].first = i;
+			}
+		}
+		if (x->trie[node].entry == D64_INDEX_NONE) {
+			x->trie[node].entry = i;
 		}
 	}
-	return true;
+}
+
+short d64_trie_match(short node, char * pattern) {
+
+	D64_INDEX * x = &g_d64.index;
+	short best = D64_INDEX_NONE;
+	short found;
+	short c;
+
+	//
+	// '*' matches the rest of the name (anything after it is ignored, as on the 1541), 
+	// '?' matches any single character. returns the lowest matching directory index.
+	//
+	if (*pattern == '*') {
+		return x->trie[node].first;
+	}
+
+	if (*pattern == 0) {
+		return x->trie[node].entry;
+	}
+
+	if (*pattern != '?') {
+		c = d64_trie_child(node,*pattern,false);
+		return c == D64_INDEX_NONE ? D64_INDEX_NONE : d64_trie_match(c,pattern + 1);
+	}
+
+	for (c = x->trie[node].child; c != D64_INDEX_NONE; c = x->trie[c].sibling) {
+		//
+		// no need to look at a subtree that can't beat what we already have.
+		//
+		if (best != D64_INDEX_NONE && x->trie[c].first >= best) {
+			continue;
+		}
+		found = d64_trie_match(c,pattern + 1);
+		if (found != D64_INDEX_NONE && (best == D64_INDEX_NONE || found < best)) {
+			best = found;
+		}
+	}
+
+	return best;
 }
 
 D64_DIRECTORY_ENTRY * d64_directory_entry_by_name(char * name) {
 
-	for (int i = 0; i < g_d64.dir.used; i++) {
-		if (d64_match_string(name,g_d64.dir.entries[i].fName)) {
-			return &g_d64.dir.entries[i];
+	D64_INDEX * x = &g_d64.index;
+	char key[D64_NAME_LENGTH + 1];
+	short i;
+
+	d64_normalize_name(key,(byte *) name,D64_NAME_LENGTH);
+
+	if (strpbrk(key,"*?")) {
+		i = d64_trie_match(0,key);
+	} else {
+		for (i = x->buckets[d64_hash_name(key)]; i != D64_INDEX_NONE && strcmp(x->names[i],key); i = x->next[i]);
+	}
+
+	return i == D64_INDEX_NONE ? NULL : &g_d64.dir.entries[i];
+}
+
+bool d64_flush_run();
+
+bool d64_flush_write() {
+
+	char tmp[PATH_MAX];
+	byte buf[0x10000];
+	struct stat st;
+	ssize_t n;
+	off_t pos = 0;
+	int fd;
+	int i;
+
+	//
+	// runs with the prefetch lock held, on the worker or during eject. writes the
+	// snapshot in g_d64journal.job* over a copy of the image then swaps it in.
+	//
+	snprintf(tmp,sizeof(tmp),"%s.tmp",g_d64.path);
+	if (fstat(g_d64.fd,&st) != 0 || (fd = open(tmp,O_WRONLY | O_CREAT | O_TRUNC,st.st_mode & 0777)) < 0) {
+		return false;
+	}
+
+	while ((n = pread(g_d64.fd,buf,sizeof(buf),pos)) > 0) {
+		if (write(fd,buf,n) != n) {
+			break;
+		}
+		pos += n;
+	}
+
+	for (i = 0; n == 0 && i < g_d64journal.jobcount; i++) {
+		if (pwrite(fd,g_d64journal.jobdata[i],D64_BYTES_PER_SECTOR,
+			(off_t) g_d64journal.jobindex[i] * D64_BYTES_PER_SECTOR) != D64_BYTES_PER_SECTOR) {
+			n = -1;
+		}
+	}
+
+	if (n != 0 || fsync(fd) != 0) {
+		close(fd);
+		unlink(tmp);
+		return false;
+	}
+
+	close(fd);
+	return rename(tmp,g_d64.path) == 0;
+}
+
+void d64_prefetch_signal() {
+
+	pthread_mutex_lock(&g_d64prefetch.waitlock);
+	pthread_cond_signal(&g_d64prefetch.wake);
+	pthread_mutex_unlock(&g_d64prefetch.waitlock);
+}
+
+bool d64_prefetch_haswork() {
+
+	return atomic_load(&g_d64prefetch.quit) ||
+		atomic_load(&g_d64journal.state) == D64_FLUSH_QUEUED ||
+		atomic_load(&g_d64prefetch.pending) ||
+		atomic_load(&g_d64prefetch.checkpost) != atomic_load(&g_d64prefetch.checkdone);
+}
+
+void d64_prefetch_check() {
+
+	struct stat st;
+	byte * image;
+	int fd;
+
+	//
+	// runs on the worker with the lock held. if the image was rewritten under us, map the
+	// new one and read it all in so the swap on the emulation thread never faults on the 
+	// host file. a host directory is listed again instead.
+	//
+	if (hostdir_ismounted()) {
+		hostdir_check();
+		return;
+	}
+
+	if (!g_d64.image || atomic_load(&g_d64prefetch.stale) || stat(g_d64.path,&st) != 0 ||
+		(st.st_mtime == g_d64.mtime && st.st_size == g_d64.imagesize)) {
+		return;
+	}
+
+	if ((fd = open(g_d64.path,O_RDONLY)) < 0) {
+		return;
+	}
+	if (fstat(fd,&st) != 0 || !st.st_size ||
+		(image = (byte *) mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE | MAP_POPULATE,fd,0)) == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+
+	g_d64prefetch.freshfd 		= fd;
+	g_d64prefetch.freshimage 	= image;
+	g_d64prefetch.freshsize 	= st.st_size;
+	g_d64prefetch.freshmtime 	= st.st_mtime;
+	atomic_store(&g_d64prefetch.stale,true);
+}
+
+void * d64_prefetch_worker(void * arg) {
+
+	unsigned check;
+	unsigned req;
+	byte track;
+	byte sector;
+	int count;
+	int i;
+
+	while (true) {
+
+		pthread_mutex_lock(&g_d64prefetch.waitlock);
+		while (!d64_prefetch_haswork()) {
+			pthread_cond_wait(&g_d64prefetch.wake,&g_d64prefetch.waitlock);
+		}
+		pthread_mutex_unlock(&g_d64prefetch.waitlock);
+
+		if (atomic_load(&g_d64prefetch.quit)) {
+			break;
+		}
+
+		pthread_mutex_lock(&g_d64prefetch.lock);
+
+		if (atomic_load(&g_d64journal.state) == D64_FLUSH_QUEUED) {
+			atomic_store(&g_d64journal.state,d64_flush_run() ? D64_FLUSH_DONE : D64_FLUSH_FAILED);
+			pthread_mutex_unlock(&g_d64prefetch.lock);
+			continue;
+		}
+
+		if ((check = atomic_load(&g_d64prefetch.checkpost)) != atomic_load(&g_d64prefetch.checkdone)) {
+			d64_prefetch_check();
+			atomic_store(&g_d64prefetch.checkdone,check);
+		}
+
+		if (!(req = atomic_exchange(&g_d64prefetch.pending,0))) {
+			pthread_mutex_unlock(&g_d64prefetch.lock);
+			continue;
+		}
+
+		//
+		// follow the chain, reading each sector from the host file. the lock keeps
+		// insert/eject from pulling the file out from under us.
+		//
+		track  = (req >> 8) & 0xFF;
+		sector = req & 0xFF;
+		count  = 0;
+
+		while (track && (req >> 16) == (g_d64prefetch.generation & 0xFFFF) && 
+			(i = d64_sector_index(track,sector)) >= 0 && count++ < D64_TOTAL_SECTORS) {
+
+			if (!atomic_load_explicit(&g_d64prefetch.valid[i],memory_order_acquire)) {
+				if (pread(g_d64.fd,g_d64prefetch.sectors[i],D64_BYTES_PER_SECTOR,(off_t) i * D64_BYTES_PER_SECTOR) != D64_BYTES_PER_SECTOR) {
+					break;
+				}
+				atomic_store_explicit(&g_d64prefetch.valid[i],true,memory_order_release);
+			}
+
+			track  = g_d64prefetch.sectors[i][0];
+			sector = g_d64prefetch.sectors[i][1];
 		}
+
+		atomic_store(&g_d64prefetch.done,req);
+		pthread_mutex_unlock(&g_d64prefetch.lock);
 	}
 
 	return NULL;
 }
 
-byte d64_count_file_sectors(D64_DIRECTORY_ENTRY *e) {
+void d64_prefetch_start() {
 
-	byte c = 0;
-	bool done = false;
-	
-	D64_SECTOR s; 
-	s.nTrack = e->fTrack;
-	s.nSector = e->fSector;
+	if (g_d64prefetch.started) {
+		return;
+	}
 
-	while (!done) {
-		d64_read(&s,sizeof(D64_SECTOR),s.nTrack,s.nSector);
-		done = s.nTrack == 0;
-		c++; 
+	pthread_mutex_init(&g_d64prefetch.lock,NULL);
+	pthread_mutex_init(&g_d64prefetch.waitlock,NULL);
+	pthread_cond_init(&g_d64prefetch.wake,NULL);
+	if (pthread_create(&g_d64prefetch.thread,NULL,d64_prefetch_worker,NULL) != 0) {
+		FATAL_ERROR("D64: Failed to start prefetch thread.\n");
 	}
+	g_d64prefetch.started = true;
+}
 
-	return c;
+void d64_shutdown() {
+
+	if (!g_d64prefetch.started) {
+		return;
+	}
+
+	atomic_store(&g_d64prefetch.quit,true);
+	d64_prefetch_signal();
+	pthread_join(g_d64prefetch.thread,NULL);
 
+	pthread_cond_destroy(&g_d64prefetch.wake);
+	pthread_mutex_destroy(&g_d64prefetch.waitlock);
+	pthread_mutex_destroy(&g_d64prefetch.lock);
+	g_d64prefetch.started = false;
 }
 
+void d64_prefetch_reset() {
 
-void d64_close_file(D64_FILE *f) {
-	free(f->data);
+	int i;
+
+	//
+	// called with the lock held whenever the image changes.
+	//
+	g_d64prefetch.generation++;
+	g_d64prefetch.requested = 0;
+	atomic_store(&g_d64prefetch.pending,0);
+	for (i = 0; i < D64_TOTAL_SECTORS; i++) {
+		atomic_store(&g_d64prefetch.valid[i],false);
+	}
 }
 
-bool d64_open_file(D64_FILE * file, char *name) {
+void d64_prefetch(D64_DIRECTORY_ENTRY * e) {
 
-	D64_DIRECTORY_ENTRY * e = d64_directory_entry_by_name(name);
-	word cur = 0; 
-	bool done = false; 
-	D64_SECTOR s; 
+	unsigned req = ((g_d64prefetch.generation & 0xFFFF) << 16) | (e->fTrack << 8) | e->fSector;
 
-	if (!e) {return false;}
+	if (!g_d64prefetch.started || e->fTrack == 0 || g_d64prefetch.requested == req) {
+		return;
+	}
 
+	g_d64prefetch.requested = req;
+	atomic_store(&g_d64prefetch.pending,req);
+	d64_prefetch_signal();
+}
 
+byte * d64_sector_cached(int i) {
 
-	file->size = d64_count_file_sectors(e) * 256;
-	DEBUG_PRINT("opening file with size %d.\n",file->size);
-	fflush(g_debug);
-	file->data = (byte *) malloc(file->size * sizeof(byte));
-	
+	if (g_d64journal.data[i]) {
+		return g_d64journal.data[i];
+	}
+	if (atomic_load_explicit(&g_d64prefetch.valid[i],memory_order_acquire)) {
+		return g_d64prefetch.sectors[i];
+	}
+	return NULL;
+}
+
+bool d64_chain_ready(D64_DIRECTORY_ENTRY * e) {
+
+	unsigned req = ((g_d64prefetch.generation & 0xFFFF) << 16) | (e->fTrack << 8) | e->fSector;
+	byte track = e->fTrack;
+	byte sector = e->fSector;
+	int count = 0;
+	byte * p;
+	int i;
+
+	while (track && count++ < D64_TOTAL_SECTORS) {
+		if ((i = d64_sector_index(track,sector)) < 0) {
+			return true; // broken chain, let the decoder report it.
+		}
+		if (!(p = d64_sector_cached(i))) {
+			//
+			// the worker gave up on this chain (read error), don't wait on it forever.
+			//
+			return atomic_load(&g_d64prefetch.done) == req;
+		}
+		track  = p[0];
+		sector = p[1];
+	}
+	return true;
+}
+
+void d64_cache_invalidate(char * path);
+
+void d64_journal_clear() {
+
+	int i;
+
+	for (i = 0; i < D64_TOTAL_SECTORS; i++) {
+		free(g_d64journal.data[i]);
+		g_d64journal.data[i] = NULL;
+	}
+	g_d64journal.count = 0;
+}
+
+bool d64_remap() {
+
+	struct stat st;
+	byte * image;
+	int fd;
+
+	//
+	// called with the lock held after we replaced the image file on the host.
+	//
+	if ((fd = open(g_d64.path,O_RDONLY)) < 0) {
+		return false;
+	}
+	if (fstat(fd,&st) != 0 || 
+		(image = (byte *) mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	munmap(g_d64.image,g_d64.imagesize);
+	close(g_d64.fd);
+
+	g_d64.fd 		= fd;
+	g_d64.image 	= image;
+	g_d64.imagesize = st.st_size;
+	g_d64.mtime 	= st.st_mtime;
+	d64_prefetch_reset();
+
+	return true;
+}
+
+void d64_flush_snapshot() {
+
+	int i;
+
+	g_d64journal.jobcount = 0;
+
+	//
+	// ascending sector order so the host sees one ordered batch of writes.
+	//
+	for (i = 0; i < D64_TOTAL_SECTORS; i++) {
+		if (g_d64journal.data[i]) {
+			g_d64journal.jobindex[g_d64journal.jobcount] = i;
+			g_d64journal.jobseq[g_d64journal.jobcount] = g_d64journal.seq[i];
+			memcpy(g_d64journal.jobdata[g_d64journal.jobcount],g_d64journal.data[i],D64_BYTES_PER_SECTOR);
+			g_d64journal.jobcount++;
+		}
+	}
+}
+
+bool d64_flush_pending() {
+	return hostdir_ismounted() ? hostdir_flush_pending() : (g_d64journal.count && g_d64.image);
+}
+
+void d64_flush_prepare() {
+
+	g_d64journal.jobhost = hostdir_ismounted();
+	if (g_d64journal.jobhost) {
+		hostdir_flush_snapshot();
+	} else {
+		d64_flush_snapshot();
+	}
+}
+
+bool d64_flush_run() {
+	return g_d64journal.jobhost ? hostdir_flush_write() : d64_flush_write();
+}
+
+void d64_flush_complete() {
+
+	int i;
+	int s;
+
+	//
+	// called with the lock held. sectors written again since the snapshot stay dirty.
+	//
+	if (g_d64journal.jobhost) {
+
+		if (atomic_load(&g_d64journal.state) == D64_FLUSH_DONE || atomic_load(&g_d64journal.state) == D64_FLUSH_FAILED) {
+			hostdir_flush_complete(atomic_load(&g_d64journal.state) == D64_FLUSH_DONE);
+		}
+		g_d64journal.jobhost = false;
+
+	} else if (atomic_load(&g_d64journal.state) == D64_FLUSH_DONE) {
+
+		for (i = 0; i < g_d64journal.jobcount; i++) {
+			s = g_d64journal.jobindex[i];
+			if (g_d64journal.data[s] && g_d64journal.seq[s] == g_d64journal.jobseq[i]) {
+				free(g_d64journal.data[s]);
+				g_d64journal.data[s] = NULL;
+				g_d64journal.count--;
+			}
+		}
+
+		DEBUG_PRINT("D64: flushed %d sectors to %s.\n",g_d64journal.jobcount,g_d64.path);
+		if (!d64_remap()) {
+			DEBUG_PRINT("D64: failed to remap %s after flush.\n",g_d64.path);
+		}
+		d64_cache_invalidate(g_d64.path);
+
+	} else if (atomic_load(&g_d64journal.state) == D64_FLUSH_FAILED) {
+		DEBUG_PRINT("D64: failed to flush %s. will retry.\n",g_d64.path);
+	}
+
+	atomic_store(&g_d64journal.state,D64_FLUSH_IDLE);
+}
+
+void d64_flush_poll() {
+
+	int state = atomic_load(&g_d64journal.state);
+
+	//
+	// never wait on the worker from the emulation thread. try again later if it is busy.
+	//
+	if ((state == D64_FLUSH_DONE || state == D64_FLUSH_FAILED) && 
+		pthread_mutex_trylock(&g_d64prefetch.lock) == 0) {
+		d64_flush_complete();
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+	}
+}
+
+void d64_flush_sync() {
+
+	//
+	// called with the lock held, so the worker is not in the middle of a job.
+	//
+	if (atomic_load(&g_d64journal.state) == D64_FLUSH_QUEUED) {
+		atomic_store(&g_d64journal.state,d64_flush_run() ? D64_FLUSH_DONE : D64_FLUSH_FAILED);
+	}
+	d64_flush_complete();
+
+	if (d64_flush_pending()) {
+		d64_flush_prepare();
+		atomic_store(&g_d64journal.state,d64_flush_run() ? D64_FLUSH_DONE : D64_FLUSH_FAILED);
+		d64_flush_complete();
+	}
+}
+
+void d64_flush_idle(void * data) {
+
+	unsigned long poll = sysclock_getticks() + sysclock_gettickspersec() / D64_FLUSH_POLL_DIVISOR;
+
+	//
+	// the disk has since gone to another machine, which flushes it from now on.
+	//
+	if (!d64_inserted()) {
+		return;
+	}
+
+	d64_flush_poll();
+
+	if (atomic_load(&g_d64journal.state) != D64_FLUSH_IDLE) {
+		sysclock_scheduleevent(g_d64machine.event,poll);
+		return;
+	}
+
+	if (!d64_flush_pending()) {
+		return;
+	}
+
+	//
+	// hand a copy of the dirty sectors (or the queued host saves) to the worker and check
+	// back on it later.
+	//
+	d64_flush_prepare();
+	atomic_store(&g_d64journal.state,D64_FLUSH_QUEUED);
+	d64_prefetch_signal();
+	sysclock_scheduleevent(g_d64machine.event,poll);
+}
+
+void d64_flush_schedule() {
+
+	//
+	// push the flush back until writes have been quiet for a while.
+	//
+	C64_STATE(d64);
+	if (!g_d64machine.haveevent) {
+		g_d64machine.event = sysclock_addevent(d64_flush_idle,NULL,PERF_VDRIVE);
+		g_d64machine.haveevent = true;
+	}
+	if (atomic_load(&g_d64journal.state) == D64_FLUSH_IDLE) {
+		sysclock_scheduleevent(g_d64machine.event,sysclock_getticks() + sysclock_gettickspersec() * D64_FLUSH_IDLE_SECONDS);
+	}
+}
+
+byte * d64_sector_write(byte track, byte sector) {
+
+	int i = d64_sector_index(track,sector);
+	byte * p;
+
+	if (i < 0) {
+		return NULL;
+	}
+
+	if (!g_d64journal.data[i]) {
+		if (!(p = (byte *) malloc(D64_BYTES_PER_SECTOR))) {
+			return NULL;
+		}
+		memcpy(p,d64_sector(track,sector),D64_BYTES_PER_SECTOR);
+		g_d64journal.data[i] = p;
+		g_d64journal.count++;
+	}
+
+	g_d64journal.seq[i] = ++g_d64journal.writeseq;
+
+	d64_flush_schedule();
+
+	return g_d64journal.data[i];
+}
+
+void d64_cache_init() {
+
+	EMU_CONFIGURATION * cfg = emu_getconfig();
+
+	g_d64cache.budget 	= cfg->diskcache ? strtoul(cfg->diskcache,NULL,10) : D64_CACHE_DEFAULT_BUDGET;
+	g_d64cache.init 	= true;
+	DEBUG_PRINT("D64: file cache budget %lu bytes.\n",g_d64cache.budget);
+}
+
+void d64_cache_unlink(D64_CACHE_ENTRY * c) {
+
+	if (c->prev) {c->prev->next = c->next;} else {g_d64cache.head = c->next;}
+	if (c->next) {c->next->prev = c->prev;} else {g_d64cache.tail = c->prev;}
+	c->prev = c->next = NULL;
+}
+
+void d64_cache_pushfront(D64_CACHE_ENTRY * c) {
+
+	c->prev = NULL;
+	c->next = g_d64cache.head;
+	if (g_d64cache.head) {g_d64cache.head->prev = c;} else {g_d64cache.tail = c;}
+	g_d64cache.head = c;
+}
+
+void d64_cache_free(D64_CACHE_ENTRY * c) {
+
+	free(c->path);
+	free(c->data);
+	free(c);
+}
+
+void d64_cache_remove(D64_CACHE_ENTRY * c) {
+
+	d64_cache_unlink(c);
+	g_d64cache.bytes -= c->size;
+
+	//
+	// somebody still has this file open. let the last close free it.
+	//
+	if (c->refs) {
+		c->stale = true;
+	} else {
+		d64_cache_free(c);
+	}
+}
+
+void d64_cache_trim() {
+
+	D64_CACHE_ENTRY * c = g_d64cache.tail;
+	D64_CACHE_ENTRY * prev;
+
+	while (c && g_d64cache.bytes > g_d64cache.budget) {
+		prev = c->prev;
+		if (c->refs == 0) {
+			d64_cache_remove(c);
+		}
+		c = prev;
+	}
+}
+
+void d64_cache_invalidate(char * path) {
+
+	D64_CACHE_ENTRY * c = g_d64cache.head;
+	D64_CACHE_ENTRY * next;
+
+	while (c) {
+		next = c->next;
+		if (!strcmp(c->path,path)) {
+			d64_cache_remove(c);
+		}
+		c = next;
+	}
+}
+
+D64_CACHE_ENTRY * d64_cache_find(D64_DIRECTORY_ENTRY * e, char * name);
+
+void d64_read_bam();
+void d64_read_directory();
+
+void d64_drop_fresh() {
+
+	munmap(g_d64prefetch.freshimage,g_d64prefetch.freshsize);
+	close(g_d64prefetch.freshfd);
+	g_d64prefetch.freshimage = NULL;
+	atomic_store(&g_d64prefetch.stale,false);
+}
+
+bool d64_swap_image() {
+
+	//
+	// the worker found the image changed and has the new one mapped. drop everything we 
+	// decoded from the old one and switch over. while we have our own writes pending, 
+	// ours win and the flush remaps.
+	//
+	if (pthread_mutex_trylock(&g_d64prefetch.lock) != 0) {
+		return false;
+	}
+
+	if (g_d64journal.count || atomic_load(&g_d64journal.state) != D64_FLUSH_IDLE) {
+		d64_drop_fresh();
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+		return true;
+	}
+
+	DEBUG_PRINT("D64: %s changed on disk. reloading.\n",g_d64.path);
+	munmap(g_d64.image,g_d64.imagesize);
+	close(g_d64.fd);
+
+	g_d64.fd 		= g_d64prefetch.freshfd;
+	g_d64.image 	= g_d64prefetch.freshimage;
+	g_d64.imagesize = g_d64prefetch.freshsize;
+	g_d64.mtime 	= g_d64prefetch.freshmtime;
+	g_d64prefetch.freshimage = NULL;
+	atomic_store(&g_d64prefetch.stale,false);
+
+	d64_prefetch_reset();
+	d64_cache_invalidate(g_d64.path);
+	d64_read_bam();
+	d64_read_directory();
+	d64_build_index();
+
+	pthread_mutex_unlock(&g_d64prefetch.lock);
+	return true;
+}
+
+bool d64_file_ready(char * name) {
+
+	D64_DIRECTORY_ENTRY * e;
+	char key[D64_NAME_LENGTH + 1];
+
+	//
+	// true if d64_open_file can run without touching the host file. otherwise starts 
+	// the work on the prefetch thread so the caller can try again later. every load first
+	// has the worker check that the image (or host directory) hasn't changed on the host.
+	//
+	if (!g_d64prefetch.started || (!hostdir_ismounted() && !g_d64.image)) {
+		return true;
+	}
+
+	if (!g_d64prefetch.checking) {
+		g_d64prefetch.checking = true;
+		atomic_store(&g_d64prefetch.checkpost,++g_d64prefetch.checkseq);
+		d64_prefetch_signal();
+	}
+
+	if (atomic_load(&g_d64prefetch.checkdone) != g_d64prefetch.checkseq) {
+		return false;
+	}
+
+	if (hostdir_ismounted()) {
+		hostdir_refresh();
+		g_d64prefetch.checking = false;
+		return true;
+	}
+
+	if (atomic_load(&g_d64prefetch.stale) && !d64_swap_image()) {
+		return false;
+	}
+
+	if ((e = d64_directory_entry_by_name(name))) {
+
+		d64_normalize_name(key,e->fName,D64_NAME_LENGTH);
+		if (!d64_cache_find(e,key) && !d64_chain_ready(e)) {
+			d64_prefetch(e);
+			return false;
+		}
+	}
+
+	g_d64prefetch.checking = false;
+	return true;
+}
+
+D64_CACHE_ENTRY * d64_cache_find(D64_DIRECTORY_ENTRY * e, char * name) {
+
+	D64_CACHE_ENTRY * c;
+
+	for (c = g_d64cache.head; c; c = c->next) {
+		if (c->fTrack == e->fTrack && c->fSector == e->fSector && c->mtime == g_d64.mtime &&
+			c->imagesize == g_d64.imagesize && !strcmp(c->name,name) && !strcmp(c->path,g_d64.path)) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+void d64_cache_add(D64_FILE * file, D64_DIRECTORY_ENTRY * e, char * name) {
+
+	D64_CACHE_ENTRY * c;
+
+	if (file->size > g_d64cache.budget || !(c = (D64_CACHE_ENTRY *) calloc(1,sizeof(D64_CACHE_ENTRY)))) {
+		return;
+	}
+
+	c->path 		= strdup(g_d64.path);
+	c->mtime 		= g_d64.mtime;
+	c->imagesize 	= g_d64.imagesize;
+	c->fTrack 		= e->fTrack;
+	c->fSector 		= e->fSector;
+	c->data 		= file->data;
+	c->size 		= file->size;
+	c->refs 		= 1;
+	strcpy(c->name,name);
+
+	file->cached = c;
+	g_d64cache.bytes += c->size;
+	d64_cache_pushfront(c);
+	d64_cache_trim();
+}
+
+void d64_close_file(D64_FILE *f) {
+
+	D64_CACHE_ENTRY * c = (D64_CACHE_ENTRY *) f->cached;
+
+	if (f->mapped) {
+		hostdir_close_file(f);
+		return;
+	}
+
+	if (c) {
+		c->refs--;
+		if (c->stale && c->refs == 0) {
+			d64_cache_free(c);
+		}
+	} else {
+		free(f->data);
+	}
+	f->data = NULL;
+	f->cached = NULL;
+}
+
+bool d64_decode_file(D64_FILE * file, D64_DIRECTORY_ENTRY * e, char * name) {
+
+	D64_SECTOR * s;
+	unsigned long alloc;
+	unsigned long len;
+	byte track;
+	byte sector;
+	int count = 0;
+
+	//
+	// directory block count is only a hint. walk the chain once, growing the buffer if 
+	// the directory lied. the last sector holds the index of its last used byte.
+	//
+	alloc = (((unsigned long) e->hFileSize << 8) | e->lFileSize) * (D64_BYTES_PER_SECTOR - 2);
+	if (alloc == 0) {
+		alloc = D64_BYTES_PER_SECTOR - 2;
+	}
+
+	file->size = 0;
+	file->cached = NULL;
+	file->data = (byte *) malloc(alloc);
 	if (!file->data) {return false;}
 
-	s.nTrack = e->fTrack;
-	s.nSector = e->fSector;
+	track  = e->fTrack;
+	sector = e->fSector;
 
-	while (!done) {
+	while (track) {
 
-		d64_read(&s,sizeof(D64_SECTOR),s.nTrack,s.nSector);
-		done = s.nTrack == 0;
-		for (int i = 0; i < D64_BYTES_PER_SECTOR - 2; i++) {
-			file->data[cur++] = s.data[i];
-		
+		s = (D64_SECTOR *) d64_sector(track,sector);
+		if (!s || ++count > D64_TOTAL_SECTORS) {
+			DEBUG_PRINT("D64: bad sector chain in file %s.\n",name);
+			d64_close_file(file);
+			return false;
 		}
+
+		len = s->nTrack ? D64_BYTES_PER_SECTOR - 2 : (s->nSector > 1 ? s->nSector - 1 : 0);
+		if (file->size + len > alloc) {
+			alloc = (file->size + len) * 2;
+			file->data = (byte *) realloc(file->data,alloc);
+			if (!file->data) {return false;}
+		}
+
+		memcpy(file->data + file->size,s->data,len);
+		file->size += len;
+
+		track  = s->nTrack;
+		sector = s->nSector;
 	}
 
-	
+	DEBUG_PRINT("opened file with size %lu.\n",file->size);
 	return true;
 }
 
+bool d64_open_file(D64_FILE * file, char *name) {
+
+	D64_DIRECTORY_ENTRY * e;
+	D64_CACHE_ENTRY * c;
+	char key[D64_NAME_LENGTH + 1];
+
+	if (hostdir_ismounted()) {
+		return hostdir_open_file(file,name);
+	}
+
+	file->mapped = false;
+	if (!g_d64cache.init) {
+		d64_cache_init();
+	}
+
+	d64_flush_poll();
+
+	if (!(e = d64_directory_entry_by_name(name))) {
+		return false;
+	}
+
+	d64_prefetch(e);
+	d64_normalize_name(key,e->fName,D64_NAME_LENGTH);
+
+	if ((c = d64_cache_find(e,key))) {
+		DEBUG_PRINT("D64: %s served from cache.\n",key);
+		c->refs++;
+		d64_cache_unlink(c);
+		d64_cache_pushfront(c);
+		file->data 		= c->data;
+		file->size 		= c->size;
+		file->cached 	= c;
+		return true;
+	}
+
+	if (!d64_decode_file(file,e,name)) {
+		return false;
+	}
+
+	d64_cache_add(file,e,key);
+	return true;
+}
 
-void d64_read_bam() {d64_read(&g_d64.bam,sizeof(D64_BAM),18,0);}
+
+void d64_read_bam() {
+
+	byte * p = d64_sector(18,0);
+
+	if (p) {
+		memcpy(&g_d64.bam,p,sizeof(D64_BAM));
+	}
+}
 
 void d64_read_directory() {
 
-	bool done = false;
-	D64_DIRECTORY_ENTRY d[8];
+	D64_DIRECTORY_ENTRY * d;
+	byte track = D64_DIR_TRACK;
+	byte sector = 1;
 	
 	g_d64.dir.used = 0;
-	d[0].nTrack = 18;
-	d[0].nSector = 1;
 
-	while (!done) {
+	while (track && g_d64.dir.used + 8 <= D64_MAX_DIRECTORY_ENTRIES) {
 
-		d64_read(&d,sizeof(D64_DIRECTORY_ENTRY)*8,d[0].nTrack,d[0].nSector);
-		done = d[0].nTrack == 0;
-		
-		for (int i = 0; i < 8;i++) {
-			g_d64.dir.entries[g_d64.dir.used++] = d[i];
+		d = (D64_DIRECTORY_ENTRY *) d64_sector(track,sector);
+		if (!d) {
+			break;
 		}
+		
+		g_d64.dir.sectors[g_d64.dir.used / 8][0] = track;
+		g_d64.dir.sectors[g_d64.dir.used / 8][1] = sector;
+		memcpy(&g_d64.dir.entries[g_d64.dir.used],d,sizeof(D64_DIRECTORY_ENTRY)*8);
+		g_d64.dir.used += 8;
+
+		track  = d[0].nTrack;
+		sector = d[0].nSector;
 	}
 }
 
+bool d64_inserted() {return atomic_load(&g_d64owner) == g_c64;}
+
 void d64_eject_disk() {
 
-	if (g_d64.file != NULL) {
+	if (g_d64prefetch.started) {
+		pthread_mutex_lock(&g_d64prefetch.lock);
+		d64_flush_sync();
+		d64_prefetch_reset();
+		if (atomic_load(&g_d64prefetch.stale)) {
+			d64_drop_fresh();
+		}
+		g_d64prefetch.checking = false;
+	}
+
+	hostdir_unmount();
 
-		fclose (g_d64.file);
-		g_d64.file = NULL;
+	//
+	// only the owner's clock has the flush event. another machine inserting a disk leaves
+	// it be, d64_flush_idle ignores a disk it no longer owns.
+	//
+	if (d64_inserted() && g_c64 && g_c64->d64 && g_d64machine.haveevent) {
+		sysclock_cancelevent(g_d64machine.event);
 	}
+
+	if (g_d64.image != NULL) {
+		munmap(g_d64.image,g_d64.imagesize);
+		g_d64.image = NULL;
+		g_d64.imagesize = 0;
+	}
+
+	if (g_d64.fd >= 0) {
+		close(g_d64.fd);
+		g_d64.fd = -1;
+	}
+
+	g_d64.dir.used = 0;
+	d64_build_index();
+	d64_journal_clear();
+
+	if (g_d64prefetch.started) {
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+	}
+	atomic_store(&g_d64owner,NULL);
 }
 
 void d64_insert_disk(char * path) {
 
+	struct stat st;
+
+	d64_prefetch_start();
 	d64_eject_disk();
-	g_d64.file = fopen(path,"rb");
+	atomic_store(&g_d64owner,g_c64);
+
+	//
+	// a directory on the host is served as the disk instead of an image. the lock keeps
+	// a check the worker still has from the last disk off it while it is set up.
+	//
+	pthread_mutex_lock(&g_d64prefetch.lock);
+	if (hostdir_mount(path)) {
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+		return;
+	}
+
 	g_d64.path = path;
-	if (g_d64.file == NULL) {
+	g_d64.fd = open(path,O_RDONLY);
+
+	if (g_d64.fd < 0 || fstat(g_d64.fd,&st) != 0) {
 		DEBUG_PRINT("D64: Failed to open %s\n",path);
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+		d64_eject_disk();
+		return;
+	}
+
+	//
+	// map the whole image. sector reads are then just pointers into the mapping.
+	//
+	g_d64.imagesize = st.st_size;
+	g_d64.mtime 	= st.st_mtime;
+	g_d64.image = (byte *) mmap(NULL,g_d64.imagesize,PROT_READ,MAP_PRIVATE,g_d64.fd,0);
+	if (g_d64.image == MAP_FAILED) {
+		DEBUG_PRINT("D64: Failed to map %s\n",path);
+		g_d64.image = NULL;
+		pthread_mutex_unlock(&g_d64prefetch.lock);
+		d64_eject_disk();
+		return;
+	}
+
+	DEBUG_PRINT("D64: disk %s inserted.\n",path);
+	d64_read_bam();
+	d64_read_directory();
+	d64_build_index();
+	d64_prefetch_reset();
+	pthread_mutex_unlock(&g_d64prefetch.lock);
+}
+
+byte * d64_bam_entry(byte track) {
+	return (byte *) &g_d64.bam.entries[track - 1];
+}
+
+bool d64_bam_isfree(byte track, byte sector) {
+	return d64_bam_entry(track)[1 + sector / 8] & (1 << (sector % 8));
+}
+
+void d64_bam_allocate(byte track, byte sector) {
+
+	if (track >= 1 && track <= D64_BAM_TRACKS && d64_bam_isfree(track,sector)) {
+		d64_bam_entry(track)[1 + sector / 8] &= ~(1 << (sector % 8));
+		d64_bam_entry(track)[0]--;
+	}
+}
+
+void d64_bam_free(byte track, byte sector) {
+
+	if (track >= 1 && track <= D64_BAM_TRACKS && !d64_bam_isfree(track,sector)) {
+		d64_bam_entry(track)[1 + sector / 8] |= (1 << (sector % 8));
+		d64_bam_entry(track)[0]++;
+	}
+}
+
+void d64_bam_commit() {
+
+	byte * p = d64_sector_write(D64_DIR_TRACK,0);
+
+	if (p) {
+		memcpy(p,&g_d64.bam,sizeof(D64_BAM));
+	}
+}
+
+bool d64_alloc_on_track(byte track, byte start, byte * sector) {
+
+	byte n = g_d64trackoffset[track + 1] - g_d64trackoffset[track];
+	byte k;
+
+	if (d64_bam_entry(track)[0] == 0) {
+		return false;
+	}
+
+	for (k = 0; k < n; k++) {
+		if (d64_bam_isfree(track,(start + k) % n)) {
+			*sector = (start + k) % n;
+			d64_bam_allocate(track,*sector);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool d64_alloc_sector(byte * track, byte * sector) {
+
+	byte d;
+
+	//
+	// stay on the previous track at the usual interleave if we can, otherwise work 
+	// outwards from the directory track like the 1541.
+	//
+	if (*track && *track != D64_DIR_TRACK && d64_alloc_on_track(*track,*sector + D64_INTERLEAVE,sector)) {
+		return true;
 	}
-	else {
-		DEBUG_PRINT("D64: disk %s inserted.\n",path);
-		d64_read_bam();
-		d64_read_directory();
 
+	for (d = 1; d < D64_BAM_TRACKS; d++) {
+		if (D64_DIR_TRACK - d >= 1 && d64_alloc_on_track(D64_DIR_TRACK - d,0,sector)) {
+			*track = D64_DIR_TRACK - d;
+			return true;
+		}
+		if (D64_DIR_TRACK + d <= D64_BAM_TRACKS && d64_alloc_on_track(D64_DIR_TRACK + d,0,sector)) {
+			*track = D64_DIR_TRACK + d;
+			return true;
+		}
+	}
+	return false;
+}
+
+word d64_blocks_free() {
+
+	word free = 0;
+	byte t;
+
+	for (t = 1; t <= D64_BAM_TRACKS; t++) {
+		if (t != D64_DIR_TRACK) {
+			free += d64_bam_entry(t)[0];
+		}
+	}
+	return free;
+}
+
+void d64_dir_write(int i) {
+
+	byte * p = d64_sector_write(g_d64.dir.sectors[i / 8][0],g_d64.dir.sectors[i / 8][1]);
+
+	//
+	// the first two bytes of each slot are only meaningful (as the link) in slot 0.
+	//
+	if (p) {
+		memcpy(p + (i % 8) * sizeof(D64_DIRECTORY_ENTRY) + 2,((byte *) &g_d64.dir.entries[i]) + 2,sizeof(D64_DIRECTORY_ENTRY) - 2);
+	}
+}
+
+int d64_dir_allocate() {
+
+	int i;
+	int last = g_d64.dir.used / 8 - 1;
+	byte sector;
+	byte * p;
+
+	for (i = 0; i < g_d64.dir.used; i++) {
+		if (g_d64.dir.entries[i].fType == 0) {
+			return i;
+		}
+	}
+
+	//
+	// directory is full, chain another block on the directory track.
+	//
+	if (last < 0 || g_d64.dir.used + 8 > D64_MAX_DIRECTORY_ENTRIES || 
+		!d64_alloc_on_track(D64_DIR_TRACK,g_d64.dir.sectors[last][1] + 3,&sector)) {
+		return -1;
+	}
+
+	if (!(p = d64_sector_write(g_d64.dir.sectors[last][0],g_d64.dir.sectors[last][1]))) {
+		return -1;
+	}
+	p[0] = g_d64.dir.entries[last * 8].nTrack  = D64_DIR_TRACK;
+	p[1] = g_d64.dir.entries[last * 8].nSector = sector;
+
+	if (!(p = d64_sector_write(D64_DIR_TRACK,sector))) {
+		return -1;
+	}
+	memset(p,0,D64_BYTES_PER_SECTOR);
+	p[1] = 0xFF;
+
+	memset(&g_d64.dir.entries[g_d64.dir.used],0,sizeof(D64_DIRECTORY_ENTRY) * 8);
+	g_d64.dir.entries[g_d64.dir.used].nSector = 0xFF;
+	g_d64.dir.sectors[g_d64.dir.used / 8][0] = D64_DIR_TRACK;
+	g_d64.dir.sectors[g_d64.dir.used / 8][1] = sector;
+	g_d64.dir.used += 8;
+
+	return g_d64.dir.used - 8;
+}
+
+void d64_disk_changed() {
+
+	d64_bam_commit();
+	d64_build_index();
+	d64_cache_invalidate(g_d64.path);
+}
+
+int d64_scratch_file(char * name) {
+
+	D64_DIRECTORY_ENTRY * e;
+	byte track;
+	byte sector;
+	byte * p;
+	int count = 0;
+
+	if (hostdir_ismounted()) {
+		return hostdir_scratch_file(name);
+	}
+	if (!g_d64.image) {
+		return D64_ERR_NODISK;
+	}
+	if (!(e = d64_directory_entry_by_name(name))) {
+		return D64_ERR_NOTFOUND;
+	}
+
+	track  = e->fTrack;
+	sector = e->fSector;
+	while (track && (p = d64_sector(track,sector)) && count++ < D64_TOTAL_SECTORS) {
+		d64_bam_free(track,sector);
+		track  = p[0];
+		sector = p[1];
+	}
+
+	e->fType = 0;
+	d64_dir_write(e - g_d64.dir.entries);
+	d64_disk_changed();
+
+	return D64_OK;
+}
+
+int d64_save_file(char * name, byte * data, unsigned long size) {
+
+	D64_DIRECTORY_ENTRY * e;
+	word blocks = size ? (size + D64_BYTES_PER_SECTOR - 3) / (D64_BYTES_PER_SECTOR - 2) : 1;
+	byte track = 0;
+	byte sector = 0;
+	byte * p = NULL;
+	byte * next;
+	unsigned long len;
+	unsigned long pos = 0;
+	int i;
+
+	if (hostdir_ismounted()) {
+		return hostdir_save_file(name,data,size);
+	}
+	if (!g_d64.image) {
+		return D64_ERR_NODISK;
 	}
+
+	//
+	// "@:name" (or "@0:name") replaces an existing file.
+	//
+	if (name[0] == '@') {
+		name += (name[1] == '0') ? 2 : 1;
+		name += (name[0] == ':') ? 1 : 0;
+		d64_scratch_file(name);
+	}
+
+	if (d64_directory_entry_by_name(name)) {
+		return D64_ERR_EXISTS;
+	}
+
+	if (d64_blocks_free() < blocks || (i = d64_dir_allocate()) < 0) {
+		return D64_ERR_FULL;
+	}
+
+	//
+	// write the chain, linking each sector as the next one is allocated.
+	//
+	while (pos < size || p == NULL) {
+
+		if (!d64_alloc_sector(&track,&sector) || !(next = d64_sector_write(track,sector))) {
+			d64_bam_commit();
+			return D64_ERR_FULL;
+		}
+
+		if (p) {
+			p[0] = track;
+			p[1] = sector;
+		} else {
+			e = &g_d64.dir.entries[i];
+			e->fTrack  = track;
+			e->fSector = sector;
+		}
+
+		p = next;
+		len = size - pos > D64_BYTES_PER_SECTOR - 2 ? D64_BYTES_PER_SECTOR - 2 : size - pos;
+		memset(p,0,D64_BYTES_PER_SECTOR);
+		memcpy(p + 2,data + pos,len);
+		p[0] = 0;
+		p[1] = len + 1;
+		pos += len;
+	}
+
+	e->fType 		= D64_FILE_CLOSED | D64_FILETYPE_PRG;
+	e->lFileSize 	= blocks & 0xFF;
+	e->hFileSize 	= blocks >> 8;
+	memset(e->fName,0xA0,D64_NAME_LENGTH);
+	memcpy(e->fName,name,strlen(name) > D64_NAME_LENGTH ? D64_NAME_LENGTH : strlen(name));
+	d64_dir_write(i);
+	d64_disk_changed();
+
+	DEBUG_PRINT("D64: saved %s (%d blocks).\n",name,blocks);
+	return D64_OK;
 }
 
 
@@ -37,8 +37,10 @@ KNOWN BUGS:
 
 typedef struct {
 
-	word 	size; 
-	byte * 	data;
+	unsigned long 	size; 		// bytes of file data (including load address for PRGs)
+	byte * 			data;		// shared with the file cache, treat as read only.
+	void * 			cached;		// cache entry backing data, if any.
+	bool 			mapped;		// data is a mapped host file, see hostdir.c.
 
 } D64_FILE;
 
@@ -46,6 +48,31 @@ typedef struct {
 void d64_track_to_sector(byte track, word * sector);
 void d64_directory(FILE * file);
 
+void d64_insert_disk(char * path);
+void d64_shutdown();							// stops the prefetch thread at exit.
+void d64_eject_disk();
+bool d64_inserted();							// by the calling machine.
+byte * d64_sector(byte track, byte sector);
+bool d64_open_file(D64_FILE * file, char *name);
+bool d64_file_ready(char * name);				// call until true before d64_open_file.
+void d64_close_file(D64_FILE *f);
+void d64_normalize_name(char * out, byte * name, int max);
+byte d64_hash_name(char * name);
+
+//
+// writes are journaled in memory and flushed to the image when idle, on eject or at exit.
+// these return one of the drive error codes below.
+//
+#define D64_OK					0
+#define D64_ERR_NOTFOUND		62
+#define D64_ERR_EXISTS			63
+#define D64_ERR_FULL			72
+#define D64_ERR_NODISK			74
+
+int d64_save_file(char * name, byte * data, unsigned long size);
+void d64_flush_schedule();						// push the idle flush back after a write.
+int d64_scratch_file(char * name);
+
 
 
 
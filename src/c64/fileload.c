@@ -0,0 +1,373 @@
+
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE:fileload.c
+direct load of various files into c64 memory.
+
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+
+/*
+BUGBUG: This is temporary. Just allows you to insert a basic program in memory without working drive/storage.
+Just hacked this together.
+
+
+
+*/
+#include <pthread.h>
+#include "emu.h"
+#include "cpu.h"
+#include "mem.h"
+#include "fileload.h"
+
+#define BAS_START_ADDRESS		0x0800
+#define BAS_END_ADDRESS			0xA000
+#define BAS_VARTAB				0x002D		// end of program: variables, arrays, free space.
+
+typedef struct {
+
+	word line;
+	byte tokens[80];
+
+} BASICLINE;
+
+typedef struct {
+
+	byte 		opcode;
+	char * 		name;
+
+} BASICOPCODE;
+
+BASICOPCODE g_basicopcodes[] = 
+{
+	{0x80,"END"},
+	{0x81,"FOR"},
+	{0x82,"NEXT"},
+	{0x83,"DATA"},
+	{0x84,"INPUT#"},
+	{0x85,"INPUT"},
+	{0x86,"DIM"},
+	{0x87,"READ"},
+	{0x88,"LET"},
+	{0x89,"GOTO"},
+	{0x8A,"RUN"},
+	{0x8B,"IF"},
+	{0x8C,"RESTORE"},
+	{0x8D,"GOSUB"},
+	{0x8E,"RETURN"},
+	{0x8F,"REM"},
+	{0x90,"STOP"},
+	{0x91,"ON"},
+	{0x92,"WAIT"},
+	{0x93,"LOAD"},
+	{0x94,"SAVE"},
+	{0x95,"VERIFY"},
+	{0x96,"DEF"},
+	{0x97,"POKE"},
+	{0x98,"PRINT#"},
+	{0x99,"PRINT"},
+	{0x9A,"CONT"},
+	{0x9B,"LIST"},
+	{0x9C,"CLR"},
+	{0x9D,"CMD"},
+	{0x9E,"SYS"},
+	{0x9F,"OPEN"},
+	{0xA0,"CLOSE"},
+	{0xA1,"GET"},
+	{0xA2,"NEW"},
+	{0xA3,"TAB("},
+	{0xA4,"TO"},
+	{0xA5,"FN"},
+	{0xA6,"SPC("},
+	{0xA7,"THEN"},
+	{0xA8,"NOT"},
+	{0xA9,"STEP"},
+	{0xAA,"+"},
+	{0xAB,"-"},
+	{0xAC,"*"},
+	{0xAD,"/"},
+	{0xAE,"^"},
+	{0xAF,"AND"},
+	{0xB0,"OR"},
+	{0xB1,">"},
+	{0xB2,"="},
+	{0xB3,"<"},
+	{0xB4,"SGN"},
+	{0xB5,"INT"},
+	{0xB6,"ABS"},
+	{0xB7,"USR"},
+	{0xB8,"FRE"},
+	{0xB9,"POS"},
+	{0xBA,"SQR"},
+	{0xBB,"RND"},
+	{0xBC,"LOG"},
+	{0xBD,"EXP"},
+	{0xBE,"COS"},
+	{0xBF,"SIN"},
+	{0xC0,"TAN"},
+	{0xC1,"ATN"},
+	{0xC2,"PEEK"},
+	{0xC3,"LEN"},
+	{0xC4,"STR$"},
+	{0xC5,"VAL"},
+	{0xC6,"ASC"},
+	{0xC7,"CHR$"},
+	{0xC8,"LEFT$"},
+	{0xC9,"RIGHT$"},
+	{0xCA,"MID$"},
+	{0xCB,"GO"},
+	{0xCD,"UNUSED"}
+};
+
+
+//
+// keywords are matched with a trie built from g_basicopcodes, one pass over each line.
+//
+#define BAS_TRIE_FIRST_CHAR		0x20
+#define BAS_TRIE_CHARS			0x40
+#define BAS_TRIE_MAX_NODES		512
+#define BAS_TOKEN_REM			0x8F
+#define BAS_TOKEN_DATA			0x83
+#define BAS_TOKEN_END_OF_TABLE	0xCD
+
+typedef struct {
+
+	short 	next[BAS_TRIE_CHARS];
+	byte 	token;					// keyword ending here, 0 if none.
+
+} BASICTRIE_NODE;
+
+BASICTRIE_NODE 	g_bastrie[BAS_TRIE_MAX_NODES];
+short 			g_bastriecount = 0;
+pthread_once_t 	g_bastrieonce = PTHREAD_ONCE_INIT;	// headless machines may load at the same time.
+
+
+short bas_triechild(short node, char c) {
+
+	byte i = (byte) c - BAS_TRIE_FIRST_CHAR;
+
+	return ((byte) c < BAS_TRIE_FIRST_CHAR || i >= BAS_TRIE_CHARS) ? 0 : g_bastrie[node].next[i];
+}
+
+void bas_buildtrie() {
+
+	short node;
+	char * c;
+	byte i;
+	int k;
+
+	memset(g_bastrie,0,sizeof(g_bastrie));
+	g_bastriecount = 1;
+
+	for (k = 0; g_basicopcodes[k].opcode != BAS_TOKEN_END_OF_TABLE; k++) {
+		node = 0;
+		for (c = g_basicopcodes[k].name; *c; c++) {
+			i = (byte) *c - BAS_TRIE_FIRST_CHAR;
+			if (!g_bastrie[node].next[i]) {
+				if (g_bastriecount == BAS_TRIE_MAX_NODES) {
+					FATAL_ERROR("%s: BASIC keyword table too large.\n",emu_getname());
+				}
+				g_bastrie[node].next[i] = g_bastriecount++;
+			}
+			node = g_bastrie[node].next[i];
+		}
+		g_bastrie[node].token = g_basicopcodes[k].opcode;
+	}
+}
+
+byte bas_matchkeyword(char * p, int * len) {
+
+	short node = 0;
+	byte token = 0;
+	int i;
+
+	//
+	// longest keyword starting at p, so INPUT# wins over INPUT and GOTO over GO.
+	//
+	for (i = 0; p[i] && (node = bas_triechild(node,p[i])); i++) {
+		if (g_bastrie[node].token) {
+			token = g_bastrie[node].token;
+			*len = i + 1;
+		}
+	}
+	return token;
+}
+
+int bas_tokenizeline(char * line, byte * out) {
+
+	byte * start = out;
+	bool quoted = false;
+	bool data = false;
+	byte token;
+	int len;
+
+	while (*line) {
+
+		if (*line == '"') {
+			quoted = !quoted;
+		} else if (data && !quoted && *line == ':') {
+			data = false;
+		}
+
+		//
+		// strings, DATA items and REM comments are copied as typed.
+		//
+		if (quoted || data || !(token = bas_matchkeyword(line,&len))) {
+			*out++ = *line++;
+			continue;
+		}
+
+		*out++ = token;
+		line += len;
+
+		if (token == BAS_TOKEN_REM) {
+			while (*line) {
+				*out++ = *line++;
+			}
+		}
+		data = token == BAS_TOKEN_DATA;
+	}
+
+	return out - start;
+}
+
+
+void asm_loadfile(char *name) {
+
+	word len;
+	word loc;
+	FILE * f;
+	byte * where;
+	f = fopen(name,"rb");
+	
+	if (f) {
+
+		fseek(f, 0, SEEK_END);          
+    	len = ftell(f);            
+    	rewind(f);
+
+		if (len < PRG_MIN_SIZE) {
+			DEBUG_PRINT("Program file %s is too short to load.\n",name);
+			fclose(f);
+			return;
+		}
+
+    	DEBUG_PRINT("Loading program file %s.\n",name);
+
+    	where = (byte *) malloc(sizeof(byte) * len);   
+		fread(where,1,len,f);
+
+		loc = where[0] | (where[1] << 8);
+		DEBUG_PRINT("\tPlacing %d bytes in memory starting at 0x%04X\n",len-2,loc);
+		mem_load_block(loc,where + 2,len - 2,MEM_TARGET_RAM);
+
+		free(where);
+		fclose(f);
+	}
+
+}
+
+
+
+void bas_loadfile(char * string) {
+
+	FILE * f;
+	char line[256];
+	char * text;
+	byte program[BAS_END_ADDRESS - BAS_START_ADDRESS];
+	word mem = 0;
+	word link;
+	word linenum;
+
+
+	DEBUG_PRINT("Loading basic file %s.\n",string);
+	f = fopen(string,"r+");
+	if (!f) {
+		return;
+	}
+
+	pthread_once(&g_bastrieonce,bas_buildtrie);
+
+	//
+	// the program is tokenized straight into a buffer and copied into memory in one go.
+	// basic starts with zero byte before first line.
+	//
+	program[mem++] = 0;
+
+ 	while (fgets(line, 256, f) && mem + sizeof(line) + 5 < sizeof(program)) {
+ 		line[strcspn(line,"\r\n")] = 0;
+ 		if (!isdigit(line[0])) {
+ 			continue;
+ 		}
+
+ 		//
+ 		// leave room for next record lnk
+ 		//
+ 		link = mem;
+ 		mem += 2;
+
+ 		linenum = strtoul(line,&text,10);
+ 		program[mem++] = linenum & 0xFF;
+ 		program[mem++] = linenum >> 8;
+
+ 		while (*text == ' ') {
+ 			text++;
+ 		}
+ 		mem += bas_tokenizeline(text,program + mem);
+
+ 		//
+ 		// trailing zero.
+ 		//
+ 		program[mem++] = 0;
+ 		//
+ 		// save link.
+ 		//
+ 		program[link] 	= (BAS_START_ADDRESS + mem) & 0xFF;
+ 		program[link+1] = (BAS_START_ADDRESS + mem) >> 8;
+    }
+
+	//
+	// end of program marker.
+	//
+	program[mem++] = 0;
+	program[mem++] = 0;
+
+	mem_load_block(BAS_START_ADDRESS,program,mem,MEM_TARGET_RAM);
+	fclose(f);
+
+	//
+	// as LOAD would, point variables past the program so RUN doesn't overwrite it.
+	//
+	for (link = 0; link < 3; link++) {
+		mem_pokeword(BAS_VARTAB + link * 2,BAS_START_ADDRESS + mem);
+	}
+}
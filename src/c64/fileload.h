@@ -33,6 +33,7 @@ direct load of various files into c64 memory.
 #ifndef FILELOAD_H
 #define FILELOAD_H
 
+#define PRG_MIN_SIZE		3		// a load address and at least one byte to put there.
 
 void bas_loadfile(char * string);
 void asm_loadfile(char * string);
@@ -0,0 +1,661 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: hostdir.c
+Host directory served as the virtual drive's disk.
+
+Files are listed once, sorted by host name and indexed by their PETSCII name. The listing
+is only rebuilt when the directory changes, which is noticed with inotify on linux and by 
+polling the directory's modification time elsewhere. The check and the rescan run on the d64
+worker before each LOAD, see d64_file_ready(), and the emulation thread only swaps the new 
+listing in. Files are mapped when opened, so a freshly built PRG is picked up on the next 
+LOAD without repacking a disk image.
+
+Host names that fold to the same PETSCII name are told apart with a ~1, ~2... suffix, 
+given in host name order. LOAD"*" is the first file in that order.
+
+SAVEs and scratches are queued in memory and show in the listing straight away. They are
+written to the host by the d64 flush worker, the same way d64 sector writes are.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "emu.h"
+#include "cpu.h"
+#include "d64.h"
+#include "hostdir.h"
+
+
+#define HOSTDIR_MAX_FILES		1024
+#define HOSTDIR_NAME_LENGTH		16
+#define HOSTDIR_HOST_LENGTH		256
+#define HOSTDIR_NONE			-1
+#define HOSTDIR_NOTIFY_BUFFER	4096
+#define HOSTDIR_MAX_SAVES		64
+
+
+typedef struct {
+
+	char 	host[HOSTDIR_HOST_LENGTH];			// file name on the host, including extension.
+	char 	name[HOSTDIR_NAME_LENGTH + 1];		// normalized PETSCII name used for lookups.
+	short 	next;								// next entry in the same hash bucket.
+	short 	save;								// queued save holding the contents, or HOSTDIR_NONE.
+
+} HOSTDIR_ENTRY;
+
+typedef struct {
+
+	char 			host[HOSTDIR_HOST_LENGTH];
+	byte * 			data;						// NULL deletes the file.
+	unsigned long 	size;
+
+} HOSTDIR_SAVE;
+
+
+typedef struct {
+
+	char * 			path;
+	bool 			mounted;
+	bool 			stale;			// worker: the directory changed since it was last read.
+	int 			notify;			// inotify descriptor, -1 when polling.
+	time_t 			mtime;			// directory modification time when polling.
+
+	HOSTDIR_ENTRY * entries;
+	short 			count;
+	short 			buckets[256];
+
+	char 			(* files)[HOSTDIR_HOST_LENGTH];		// host files as last read.
+	short 			filecount;
+
+	//
+	// a rescan done by the worker, waiting for the emulation thread to swap it in.
+	//
+	char 			(* scanfiles)[HOSTDIR_HOST_LENGTH];
+	short 			scancount;
+	atomic_bool 	scanned;
+
+	//
+	// writes not on the host yet, oldest first. the flush worker only reads the first 
+	// jobcount of them, so new ones can be added while it runs.
+	//
+	HOSTDIR_SAVE 	saves[HOSTDIR_MAX_SAVES];
+	int 			savecount;
+	int 			jobcount;
+
+} HOSTDIR;
+
+HOSTDIR g_hostdir = {.notify = -1};
+
+
+
+bool hostdir_ismounted() {
+	return g_hostdir.mounted;
+}
+
+bool hostdir_is_program(char * host) {
+
+	char * ext = strrchr(host,'.');
+
+	return ext && ext != host && (!strcasecmp(ext,".prg") || !strcasecmp(ext,".seq"));
+}
+
+void hostdir_to_petscii(char * out, char * host) {
+
+	int i;
+
+	//
+	// host names are usually lower case, which is upper case (unshifted) PETSCII.
+	// anything outside the printable unshifted range becomes a wildcard character.
+	//
+	for (i = 0; i < HOSTDIR_NAME_LENGTH && host[i] && host + i != strrchr(host,'.'); i++) {
+		out[i] = toupper(host[i]);
+		if (out[i] < 0x20 || out[i] > 0x5D) {
+			out[i] = '?';
+		}
+	}
+	out[i] = 0;
+}
+
+void hostdir_to_ascii(char * out, char * name) {
+
+	byte c;
+	int i;
+
+	for (i = 0; i < HOSTDIR_NAME_LENGTH && name[i]; i++) {
+
+		c = name[i];
+
+		if (c >= 'A' && c <= 'Z') {
+			c = tolower(c);
+		} else if (c >= 0xC1 && c <= 0xDA) {
+			c = c - 0xC1 + 'A';
+		} else if (c < 0x20 || c >= 0x7F || c == '/' || c == '\\' || c == '*' || c == '?') {
+			c = '_';
+		}
+		out[i] = c;
+	}
+	strcpy(out + i,".prg");
+}
+
+bool hostdir_match(char * pattern, char * name) {
+
+	//
+	// CBM wildcards: '?' matches any one character, '*' matches the rest of the name.
+	//
+	while (*pattern && *pattern != '*') {
+		if (!*name || (*pattern != '?' && *pattern != *name)) {
+			return false;
+		}
+		pattern++;
+		name++;
+	}
+	return *pattern == '*' || !*name;
+}
+
+int hostdir_compare(const void * a, const void * b) {
+	return strcmp(((HOSTDIR_ENTRY *) a)->host,((HOSTDIR_ENTRY *) b)->host);
+}
+
+short hostdir_lookup(char * key) {
+
+	short i;
+
+	for (i = g_hostdir.buckets[d64_hash_name(key)]; i != HOSTDIR_NONE && strcmp(g_hostdir.entries[i].name,key); 
+		i = g_hostdir.entries[i].next);
+
+	return i;
+}
+
+void hostdir_index() {
+
+	HOSTDIR_ENTRY * e;
+	char suffix[8];
+	byte h;
+	int i;
+	int j;
+	int n;
+
+	//
+	// the listing is the host files with the queued saves applied on top.
+	//
+	g_hostdir.count = 0;
+	for (i = 0; i < g_hostdir.filecount; i++) {
+		e = &g_hostdir.entries[g_hostdir.count++];
+		strcpy(e->host,g_hostdir.files[i]);
+		e->save = HOSTDIR_NONE;
+	}
+
+	for (i = 0; i < g_hostdir.savecount; i++) {
+
+		for (j = 0; j < g_hostdir.count && strcmp(g_hostdir.entries[j].host,g_hostdir.saves[i].host); j++);
+
+		if (!g_hostdir.saves[i].data) {
+			if (j < g_hostdir.count) {
+				g_hostdir.entries[j] = g_hostdir.entries[--g_hostdir.count];
+			}
+			continue;
+		}
+		if (j == g_hostdir.count) {
+			if (g_hostdir.count == HOSTDIR_MAX_FILES) {
+				continue;
+			}
+			strcpy(g_hostdir.entries[g_hostdir.count++].host,g_hostdir.saves[i].host);
+		}
+		g_hostdir.entries[j].save = i;
+	}
+
+	//
+	// in host name order, so wildcards and names that fold together come out the same on
+	// every host and file system. a name already taken gets a ~n suffix.
+	//
+	qsort(g_hostdir.entries,g_hostdir.count,sizeof(HOSTDIR_ENTRY),hostdir_compare);
+	memset(g_hostdir.buckets,0xFF,sizeof(g_hostdir.buckets));
+
+	for (i = 0; i < g_hostdir.count; i++) {
+
+		e = &g_hostdir.entries[i];
+		hostdir_to_petscii(e->name,e->host);
+
+		for (n = 1; hostdir_lookup(e->name) != HOSTDIR_NONE; n++) {
+			j = snprintf(suffix,sizeof(suffix),"~%d",n);
+			hostdir_to_petscii(e->name,e->host);
+			e->name[HOSTDIR_NAME_LENGTH - j] = 0;
+			strcat(e->name,suffix);
+		}
+
+		h = d64_hash_name(e->name);
+		e->next = g_hostdir.buckets[h];
+		g_hostdir.buckets[h] = i;
+	}
+}
+
+short hostdir_read(char (* files)[HOSTDIR_HOST_LENGTH]) {
+
+	DIR * d;
+	struct dirent * de;
+	struct stat st;
+	char path[PATH_MAX];
+	short count = 0;
+
+	if (!(d = opendir(g_hostdir.path))) {
+		DEBUG_PRINT("HOSTDIR: failed to read %s\n",g_hostdir.path);
+		return 0;
+	}
+
+	while ((de = readdir(d)) && count < HOSTDIR_MAX_FILES) {
+
+		if (!hostdir_is_program(de->d_name) || strlen(de->d_name) >= HOSTDIR_HOST_LENGTH) {
+			continue;
+		}
+
+		snprintf(path,sizeof(path),"%s/%s",g_hostdir.path,de->d_name);
+		if (stat(path,&st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		strcpy(files[count++],de->d_name);
+	}
+
+	closedir(d);
+	return count;
+}
+
+void hostdir_check() {
+
+	struct stat st;
+#ifdef __linux__
+	byte buf[HOSTDIR_NOTIFY_BUFFER];
+#endif
+
+	//
+	// runs on the d64 worker with the d64 lock held, before each LOAD. a rescan that 
+	// hasn't been swapped in yet is simply read over.
+	//
+#ifdef __linux__
+	if (g_hostdir.notify >= 0) {
+		while (read(g_hostdir.notify,buf,sizeof(buf)) > 0) {
+			g_hostdir.stale = true;
+		}
+	} else
+#endif
+	if (stat(g_hostdir.path,&st) == 0 && st.st_mtime != g_hostdir.mtime) {
+		g_hostdir.mtime = st.st_mtime;
+		g_hostdir.stale = true;
+	}
+
+	if (g_hostdir.stale) {
+		g_hostdir.stale 	= false;
+		g_hostdir.scancount = hostdir_read(g_hostdir.scanfiles);
+		atomic_store(&g_hostdir.scanned,true);
+	}
+}
+
+void hostdir_refresh() {
+
+	char (* files)[HOSTDIR_HOST_LENGTH] = g_hostdir.files;
+
+	//
+	// emulation thread, once the worker's check is done and it has let go of scanfiles.
+	//
+	if (!atomic_load(&g_hostdir.scanned)) {
+		return;
+	}
+
+	g_hostdir.files 	= g_hostdir.scanfiles;
+	g_hostdir.filecount = g_hostdir.scancount;
+	g_hostdir.scanfiles = files;
+	atomic_store(&g_hostdir.scanned,false);
+
+	hostdir_index();
+	DEBUG_PRINT("HOSTDIR: %d files in %s.\n",g_hostdir.count,g_hostdir.path);
+}
+
+HOSTDIR_ENTRY * hostdir_find(char * name) {
+
+	char key[HOSTDIR_NAME_LENGTH + 1];
+	short i;
+
+	d64_normalize_name(key,(byte *) name,HOSTDIR_NAME_LENGTH);
+
+	//
+	// shifted letters save as upper case on the host, so match them without case too.
+	//
+	for (i = 0; key[i]; i++) {
+		if ((byte) key[i] >= 0xC1 && (byte) key[i] <= 0xDA) {
+			key[i] = key[i] - 0xC1 + 'A';
+		}
+	}
+
+	if (strpbrk(key,"*?")) {
+		for (i = 0; i < g_hostdir.count && !hostdir_match(key,g_hostdir.entries[i].name); i++);
+		return i < g_hostdir.count ? &g_hostdir.entries[i] : NULL;
+	}
+
+	i = hostdir_lookup(key);
+
+	return i == HOSTDIR_NONE ? NULL : &g_hostdir.entries[i];
+}
+
+bool hostdir_mount(char * path) {
+
+	struct stat st;
+
+	if (stat(path,&st) != 0 || !S_ISDIR(st.st_mode)) {
+		return false;
+	}
+
+	hostdir_unmount();
+
+	if (!g_hostdir.entries && 
+		(!(g_hostdir.entries = (HOSTDIR_ENTRY *) malloc(sizeof(HOSTDIR_ENTRY) * HOSTDIR_MAX_FILES)) ||
+		!(g_hostdir.files = malloc(sizeof(*g_hostdir.files) * HOSTDIR_MAX_FILES)) ||
+		!(g_hostdir.scanfiles = malloc(sizeof(*g_hostdir.scanfiles) * HOSTDIR_MAX_FILES)))) {
+		FATAL_ERROR("%s: out of memory for the host directory listing.\n",emu_getname());
+	}
+
+	g_hostdir.path 		= path;
+	g_hostdir.mtime 	= st.st_mtime;
+	g_hostdir.mounted 	= true;
+
+#ifdef __linux__
+	g_hostdir.notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (g_hostdir.notify >= 0 && inotify_add_watch(g_hostdir.notify,path,
+		IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+		close(g_hostdir.notify);
+		g_hostdir.notify = -1;
+	}
+#endif
+
+	//
+	// the first listing is read here, inserting a disk is allowed to wait on the host.
+	//
+	DEBUG_PRINT("HOSTDIR: %s mounted (%s).\n",path,g_hostdir.notify >= 0 ? "inotify" : "polling");
+	g_hostdir.stale 	= false;
+	g_hostdir.filecount = hostdir_read(g_hostdir.files);
+	hostdir_index();
+	DEBUG_PRINT("HOSTDIR: %d files in %s.\n",g_hostdir.count,g_hostdir.path);
+
+	return true;
+}
+
+void hostdir_unmount() {
+
+	int i;
+
+	//
+	// d64_eject_disk has flushed the queued saves by now. any left failed to write.
+	//
+	for (i = 0; i < g_hostdir.savecount; i++) {
+		free(g_hostdir.saves[i].data);
+	}
+	if (g_hostdir.savecount) {
+		DEBUG_PRINT("HOSTDIR: %d saves could not be written to %s.\n",g_hostdir.savecount,g_hostdir.path);
+	}
+	g_hostdir.savecount = 0;
+	g_hostdir.jobcount 	= 0;
+
+	if (g_hostdir.notify >= 0) {
+		close(g_hostdir.notify);
+		g_hostdir.notify = -1;
+	}
+	g_hostdir.mounted = false;
+	g_hostdir.count = 0;
+	g_hostdir.filecount = 0;
+	atomic_store(&g_hostdir.scanned,false);
+}
+
+void hostdir_directory() {
+
+	short i;
+
+	for (i = 0; i < g_hostdir.count; i++) {
+		DEBUG_PRINT("%-40s [%s]\n",g_hostdir.entries[i].name,g_hostdir.entries[i].host);
+	}
+}
+
+bool hostdir_open_file(D64_FILE * file, char * name) {
+
+	HOSTDIR_ENTRY * e;
+	struct stat st;
+	char path[PATH_MAX];
+	int fd;
+
+	if (!(e = hostdir_find(name))) {
+		return false;
+	}
+
+	//
+	// saved but not written to the host yet.
+	//
+	if (e->save != HOSTDIR_NONE) {
+		if (!(file->data = (byte *) malloc(g_hostdir.saves[e->save].size))) {
+			return false;
+		}
+		memcpy(file->data,g_hostdir.saves[e->save].data,g_hostdir.saves[e->save].size);
+		file->size 		= g_hostdir.saves[e->save].size;
+		file->cached 	= NULL;
+		file->mapped 	= false;
+		return true;
+	}
+
+	snprintf(path,sizeof(path),"%s/%s",g_hostdir.path,e->host);
+	if ((fd = open(path,O_RDONLY)) < 0) {
+		return false;
+	}
+
+	//
+	// the mapping stays valid after the descriptor is closed.
+	//
+	if (fstat(fd,&st) != 0 || st.st_size == 0 ||
+		(file->data = (byte *) mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED) {
+		file->data = NULL;
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	file->size 		= st.st_size;
+	file->cached 	= NULL;
+	file->mapped 	= true;
+
+	DEBUG_PRINT("HOSTDIR: opened %s (%lu bytes).\n",e->host,file->size);
+	return true;
+}
+
+void hostdir_close_file(D64_FILE * file) {
+
+	if (file->data) {
+		munmap(file->data,file->size);
+	}
+	file->data 		= NULL;
+	file->mapped 	= false;
+}
+
+bool hostdir_queue(char * host, byte * data, unsigned long size) {
+
+	HOSTDIR_SAVE * s;
+
+	if (g_hostdir.savecount == HOSTDIR_MAX_SAVES) {
+		return false;
+	}
+
+	s = &g_hostdir.saves[g_hostdir.savecount];
+	s->data = NULL;
+	s->size = size;
+	if (data && !(s->data = (byte *) malloc(size ? size : 1))) {
+		return false;
+	}
+	if (data) {
+		memcpy(s->data,data,size);
+	}
+	strcpy(s->host,host);
+	g_hostdir.savecount++;
+
+	hostdir_index();
+	d64_flush_schedule();
+	return true;
+}
+
+int hostdir_scratch_file(char * name) {
+
+	HOSTDIR_ENTRY * e;
+
+	if (!g_hostdir.mounted) {
+		return D64_ERR_NODISK;
+	}
+	if (!(e = hostdir_find(name))) {
+		return D64_ERR_NOTFOUND;
+	}
+
+	return hostdir_queue(e->host,NULL,0) ? D64_OK : D64_ERR_FULL;
+}
+
+int hostdir_save_file(char * name, byte * data, unsigned long size) {
+
+	char host[HOSTDIR_HOST_LENGTH];
+
+	if (!g_hostdir.mounted) {
+		return D64_ERR_NODISK;
+	}
+
+	//
+	// "@:name" (or "@0:name") replaces an existing file.
+	//
+	if (name[0] == '@') {
+		name += (name[1] == '0') ? 2 : 1;
+		name += (name[0] == ':') ? 1 : 0;
+		hostdir_scratch_file(name);
+	}
+
+	if (hostdir_find(name)) {
+		return D64_ERR_EXISTS;
+	}
+
+	hostdir_to_ascii(host,name);
+	if (!hostdir_queue(host,data,size)) {
+		return D64_ERR_FULL;
+	}
+
+	DEBUG_PRINT("HOSTDIR: saved %s.\n",host);
+	return D64_OK;
+}
+
+bool hostdir_flush_pending() {
+	return g_hostdir.savecount != 0;
+}
+
+void hostdir_flush_snapshot() {
+	g_hostdir.jobcount = g_hostdir.savecount;
+}
+
+bool hostdir_flush_write() {
+
+	HOSTDIR_SAVE * s;
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	FILE * f;
+	bool ok;
+	int i;
+
+	//
+	// runs on the flush worker with the d64 lock held, or during eject. each file is
+	// written next to its target then renamed, so a watcher never sees half a file.
+	//
+	for (i = 0; i < g_hostdir.jobcount; i++) {
+
+		s = &g_hostdir.saves[i];
+		snprintf(path,sizeof(path),"%s/%s",g_hostdir.path,s->host);
+
+		if (!s->data) {
+			if (unlink(path) != 0 && errno != ENOENT) {
+				return false;
+			}
+			continue;
+		}
+
+		snprintf(tmp,sizeof(tmp),"%s/.%s.tmp",g_hostdir.path,s->host);
+		if (!(f = fopen(tmp,"wb"))) {
+			return false;
+		}
+		ok = fwrite(s->data,1,s->size,f) == s->size;
+		ok = (fclose(f) == 0) && ok;
+
+		if (!ok || rename(tmp,path) != 0) {
+			unlink(tmp);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void hostdir_flush_complete(bool written) {
+
+	HOSTDIR_SAVE * s;
+	int i;
+	int j;
+
+	//
+	// called with the d64 lock held. a failed job stays queued and is tried again.
+	// a written one goes into the host listing as is, rather than waiting on a rescan.
+	//
+	for (i = 0; written && i < g_hostdir.jobcount; i++) {
+
+		s = &g_hostdir.saves[i];
+		for (j = 0; j < g_hostdir.filecount && strcmp(g_hostdir.files[j],s->host); j++);
+
+		if (!s->data && j < g_hostdir.filecount) {
+			g_hostdir.filecount--;
+			memmove(g_hostdir.files[j],g_hostdir.files[g_hostdir.filecount],sizeof(g_hostdir.files[j]));
+		} else if (s->data && j == g_hostdir.filecount && j < HOSTDIR_MAX_FILES) {
+			strcpy(g_hostdir.files[g_hostdir.filecount++],s->host);
+		}
+		free(s->data);
+	}
+
+	if (written) {
+		DEBUG_PRINT("HOSTDIR: wrote %d changes to %s.\n",g_hostdir.jobcount,g_hostdir.path);
+		g_hostdir.savecount -= g_hostdir.jobcount;
+		memmove(g_hostdir.saves,g_hostdir.saves + g_hostdir.jobcount,sizeof(HOSTDIR_SAVE) * g_hostdir.savecount);
+		hostdir_index();
+	}
+	g_hostdir.jobcount = 0;
+}
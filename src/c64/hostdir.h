@@ -0,0 +1,70 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: hostdir.h
+Host directory served as the virtual drive's disk.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef HOSTDIR_H
+#define HOSTDIR_H
+
+#include "d64.h"
+
+//
+// a directory of .prg/.seq files on the host can be inserted in place of a d64 image.
+// d64_insert_disk() mounts it when given a directory and the d64_ file calls are 
+// passed through to here while it is mounted.
+//
+bool hostdir_mount(char * path);
+void hostdir_unmount();
+bool hostdir_ismounted();
+void hostdir_directory();
+
+//
+// changes on the host are looked for by the d64 worker before each LOAD.
+//
+void hostdir_check();							// worker, with the d64 lock held.
+void hostdir_refresh();							// emulation thread, once the check is done.
+
+bool hostdir_open_file(D64_FILE * file, char * name);
+void hostdir_close_file(D64_FILE * file);
+int hostdir_save_file(char * name, byte * data, unsigned long size);
+int hostdir_scratch_file(char * name);
+
+//
+// saves and scratches are queued and written to the host by the d64 flush worker.
+//
+bool hostdir_flush_pending();
+void hostdir_flush_snapshot();					// hand the queue so far to the worker.
+bool hostdir_flush_write();						// worker, with the d64 lock held.
+void hostdir_flush_complete(bool written);		// d64 lock held.
+
+#endif
@@ -29,9 +29,25 @@ Commodore 64 Joystick emulation.
 */
 #include "emu.h"
 #include "joystick.h"
+#include "c64kbd.h"
+#include "c64.h"
 
 
-byte g_joyports[2] = {0xff,0xff};
+typedef struct _JOYSTICK {
+
+	byte ports[2];
+
+} JOYSTICK;
+
+#define g_joyports 	(g_c64->joy->ports)
+
+
+void joy_init() {
+
+	C64_STATE(joy);
+	g_joyports[0] = 0xff;
+	g_joyports[1] = 0xff;
+}
 
 
 byte joy_getport(byte port) {
@@ -50,4 +66,10 @@ void joy_input(byte port, byte in, bool pressed) {
 	else {
 		g_joyports[port] |= in;
 	}
+	//
+	// port 1 is read through the keyboard scan table.
+	//
+	if (port == 1) {
+		c64kbd_buildscan();
+	}
 }
\ No newline at end of file
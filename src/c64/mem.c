@@ -37,6 +37,10 @@ KNOWN BUGS:
 #include "emu.h"
 #include "cpu.h"
 #include "mem.h"
+#include "snapshot.h"
+#include "perf.h"
+#include "cart.h"
+#include "c64.h"
 
 typedef struct {
 
@@ -51,14 +55,55 @@ typedef struct {
 } MEMORY_MAP;
 
 #define MAX_MEMORY_MAPS 30 // arbitrary
+#define MAX_DIRTY_CONSUMERS 8
+#define MEM_CART_CHUNK 		0x2000	// size of a cartridge rom chip.
 
+//
+// something watching for ram writes. a page is dirty for it when the page was stamped with a
+// later epoch than the one it last cleared at.
+//
 typedef struct {
+
+	uint32_t 	epoch;
+	byte * 		written;	// optional bit per address, filled in from g_memory.written.
+
+} MEMORY_DIRTY;
+
+typedef struct _MEMORY {
 	byte 		ram  [MEM_PAGE_SIZE * MEM_PAGE_COUNT];
 	MEMORY_MAP 	maps [MAX_MEMORY_MAPS];
 	byte 		mapNext;
+
+	//
+	// write tracking. each write stamps its page with the current epoch and sets its address
+	// bit. consumers only ever move the epoch forward, so they clear without touching the pages.
+	//
+	uint32_t 		pageEpoch[MEM_PAGE_COUNT];
+	byte 			written[MEM_SIZE / 8];		// addresses written since the last fold.
+	uint32_t 		epoch;
+	uint32_t 		foldEpoch;
+	MEMORY_DIRTY 	consumers[MAX_DIRTY_CONSUMERS];
+	byte 			consumerNext;
 } MEMORY;
 
-MEMORY g_memory;
+#define g_memory 	(*g_c64->memory)
+
+
+//
+// writes that reach ram stamp their page and set their address bit. a store and an or, no 
+// matter how many consumers are watching.
+//
+#define MEM_MARKPAGE(a)		(g_memory.pageEpoch[(a) >> 8] = g_memory.epoch, \
+							 g_memory.written[(a) >> 3] |= 1 << ((a) & 7))
+
+void mem_markdirty(word address, unsigned long len) {
+
+	unsigned long a;
+
+	for (a = address; a < address + len; a++) {
+		MEM_MARKPAGE(a);
+	}
+}
 
 
 byte mem_map(word low, word high, PEEKHANDLER peekfn, POKEHANDLER pokefn) {
@@ -77,10 +122,39 @@ byte mem_map(word low, word high, PEEKHANDLER peekfn, POKEHANDLER pokefn) {
 
 void mem_mapactive(byte map, bool flag) {g_memory.maps[map].active = flag;}
 
+void mem_loadstate(void * state, byte * data) {
+
+	//
+	// everything may have changed.
+	//
+	memcpy(g_memory.ram,data,sizeof(g_memory.ram));
+	mem_markdirty(0,MEM_SIZE);
+}
+
 void mem_init() {
 	DEBUG_PRINT("** Initializing Memory...\n");
-	memset(&g_memory,0,sizeof(MEMORY));}
-void mem_destroy() {}
+	C64_STATE(memory);
+	mem_destroy();
+	memset(&g_memory,0,sizeof(MEMORY));
+	snapshot_register("RAM ",1,g_memory.ram,sizeof(g_memory.ram),mem_loadstate);
+
+	//
+	// consumers start at epoch 0, so every page counts as written when they register.
+	//
+	g_memory.epoch = 1;
+	mem_markdirty(0,MEM_SIZE);
+}
+
+void mem_destroy() {
+
+	byte i;
+
+	for (i = 0; i < g_memory.consumerNext; i++) {
+		free(g_memory.consumers[i].written);
+		g_memory.consumers[i].written = NULL;
+	}
+	g_memory.consumerNext = 0;
+}
 
 MEMORY_MAP *mem_getmap(address) {
 	
@@ -95,25 +169,32 @@ MEMORY_MAP *mem_getmap(address) {
 	return NULL;
 }
 
-void mem_nonmappable_poke(word address,byte value) {g_memory.ram[address] = value;}
+void mem_nonmappable_poke(word address,byte value) {g_memory.ram[address] = value; MEM_MARKPAGE(address);}
 byte mem_nonmappable_peek(word address) {return g_memory.ram[address];}
 
 void mem_poke(word address,byte value) {
 
 	MEMORY_MAP * map = mem_getmap(address);
 	if (map) {
+		PERF_ENTER();
 		map->poke(address-map->low,value);
+		PERF_LEAVE(PERF_MEM);
 	}
 	else {
 		g_memory.ram[address] = value;
+		MEM_MARKPAGE(address);
 	}
 }
 byte mem_peek(word address) {
 
 	MEMORY_MAP * map = mem_getmap(address);
+	byte value;
 
 	if (map) {
-		return map->peek(address-map->low);
+		PERF_ENTER();
+		value = map->peek(address-map->low);
+		PERF_LEAVE(PERF_MEM);
+		return value;
 	}
 	else {
 		return g_memory.ram[address];
@@ -128,3 +209,153 @@ word mem_peekword(word address) {
 	return (mem_peek(address+1) << 8) | mem_peek(address);
 }
 
+byte * mem_getram() {return g_memory.ram;}
+
+//
+// hand the address bits written since the last fold to the consumers that want them. only 
+// pages stamped since then can have any set.
+//
+void mem_folddirty() {
+
+	MEMORY_DIRTY * c;
+	int page;
+	int i;
+	byte j;
+
+	for (page = 0; page < MEM_PAGE_COUNT; page++) {
+
+		if (g_memory.pageEpoch[page] <= g_memory.foldEpoch) {
+			continue;
+		}
+
+		for (j = 0; j < g_memory.consumerNext; j++) {
+			c = &g_memory.consumers[j];
+			for (i = 0; c->written && i < MEM_PAGE_SIZE / 8; i++) {
+				c->written[page * MEM_PAGE_SIZE / 8 + i] |= g_memory.written[page * MEM_PAGE_SIZE / 8 + i];
+			}
+		}
+		memset(&g_memory.written[page * MEM_PAGE_SIZE / 8],0,MEM_PAGE_SIZE / 8);
+	}
+
+	g_memory.foldEpoch = g_memory.epoch++;
+}
+
+byte mem_dirtyregister(bool addresses) {
+
+	MEMORY_DIRTY * c;
+
+	if (g_memory.consumerNext == MAX_DIRTY_CONSUMERS) {
+		FATAL_ERROR("Memory: Out of dirty tracking consumers.\n");
+	}
+
+	c = &g_memory.consumers[g_memory.consumerNext];
+	c->epoch = 0;
+
+	if (addresses) {
+		if (!(c->written = (byte *) malloc(MEM_SIZE / 8))) {
+			FATAL_ERROR("Memory: Out of memory for dirty tracking.\n");
+		}
+		memset(c->written,0xFF,MEM_SIZE / 8);
+	}
+
+	return g_memory.consumerNext++;
+}
+
+bool mem_pagedirty(byte id, byte page) {
+	return g_memory.pageEpoch[page] > g_memory.consumers[id].epoch;
+}
+
+bool mem_addressdirty(byte id, word address) {
+
+	MEMORY_DIRTY * c = &g_memory.consumers[id];
+
+	if (!c->written) {
+		return mem_pagedirty(id,address >> 8);
+	}
+
+	if (g_memory.pageEpoch[address >> 8] > g_memory.foldEpoch) {
+		mem_folddirty();
+	}
+	return c->written[address >> 3] & (1 << (address & 7));
+}
+
+void mem_cleardirty(byte id) {
+
+	MEMORY_DIRTY * c = &g_memory.consumers[id];
+
+	//
+	// BUGBUG: a 32 bit epoch wraps after four billion clears. nothing clears anywhere near 
+	// that often.
+	//
+	if (c->written) {
+		mem_folddirty();
+		memset(c->written,0,MEM_SIZE / 8);
+	}
+	c->epoch = g_memory.epoch++;
+}
+
+unsigned long mem_nextmap(word address) {
+
+	unsigned long next = MEM_SIZE;
+	int i;
+
+	for (i = 0; i < g_memory.mapNext; i++) {
+		if (g_memory.maps[i].active && g_memory.maps[i].low > address && g_memory.maps[i].low < next) {
+			next = g_memory.maps[i].low;
+		}
+	}
+	return next;
+}
+
+void mem_load_block(word address, byte * data, unsigned long len, MEM_TARGET target) {
+
+	MEMORY_MAP * map;
+	unsigned long run;
+	unsigned long i;
+
+	while (len) {
+
+		//
+		// split at the top of memory (wrapping to 0 like the cpu would) and, for mapped 
+		// loads, wherever a map starts or ends.
+		//
+		run = MEM_SIZE - address;
+		if (run > len) {
+			run = len;
+		}
+
+		//
+		// cartridge chips are 8K, so loads into them split on 8K boundaries.
+		//
+		if (target == MEM_TARGET_CART && run > MEM_CART_CHUNK - (address & (MEM_CART_CHUNK - 1))) {
+			run = MEM_CART_CHUNK - (address & (MEM_CART_CHUNK - 1));
+		}
+
+		if (target == MEM_TARGET_CART && cart_load_block(address,data,run)) {
+			address += run;
+			data 	+= run;
+			len 	-= run;
+			continue;
+		}
+
+		if (target == MEM_TARGET_MAPPED && (map = mem_getmap(address))) {
+			if (run > (unsigned long) map->high - address + 1) {
+				run = map->high - address + 1;
+			}
+			for (i = 0; i < run; i++) {
+				mem_poke(address + i,data[i]);
+			}
+		} else {
+			if (target == MEM_TARGET_MAPPED && run > mem_nextmap(address) - address) {
+				run = mem_nextmap(address) - address;
+			}
+			memcpy(&g_memory.ram[address],data,run);
+		}
+
+		mem_markdirty(address,run);
+		address += run;
+		data 	+= run;
+		len 	-= run;
+	}
+}
+
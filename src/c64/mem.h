@@ -39,8 +39,21 @@ typedef void (*POKEHANDLER)(word,byte);
 typedef byte (*PEEKHANDLER)(word);
 
 
-#define MEM_PAGE_SIZE 	0xFF
-#define MEM_PAGE_COUNT 	0xFF
+#define MEM_PAGE_SIZE 	0x100
+#define MEM_PAGE_COUNT 	0x100
+#define MEM_SIZE		(MEM_PAGE_SIZE * MEM_PAGE_COUNT)
+
+//
+// where mem_load_block() puts data. MEM_TARGET_RAM writes the ram underneath any rom or 
+// i/o like a KERNAL LOAD does, MEM_TARGET_MAPPED goes through active maps like mem_poke.
+// MEM_TARGET_CART writes the cartridge's selected bank where its roms sit ($8000-$BFFF,
+// $E000-$FFFF), whether they are banked in or not, and ram everywhere else.
+//
+typedef enum {
+	MEM_TARGET_RAM,
+	MEM_TARGET_MAPPED,
+	MEM_TARGET_CART
+} MEM_TARGET;
 
 
 void mem_init();
@@ -52,6 +65,22 @@ void mem_pokeword(word address,word value);
 byte mem_peek(word address);
 word mem_peekword(word address);
 
+//
+// bulk loads. the pages they touch are marked dirty for anything caching memory contents.
+//
+void mem_load_block(word address, byte * data, unsigned long len, MEM_TARGET target);
+byte * mem_getram();
+
+//
+// ram write tracking. each consumer (snapshots, caches, displays) registers for an id and 
+// clears it on its own schedule. everything counts as written until the first clear. pass
+// addresses to also track single bytes, at 8K for the consumer and a little work per query.
+//
+byte mem_dirtyregister(bool addresses);
+bool mem_pagedirty(byte id, byte page);
+bool mem_addressdirty(byte id, word address);
+void mem_cleardirty(byte id);
+
 
 
 
@@ -0,0 +1,186 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-------------------------------------------------------------------------------
+MODULE: perf.c
+Host time and emulated work attributed to each subsystem of the bound machine.
+
+Always on. Calls are counted on every update and time is sampled, see perf.h. Every machine
+keeps its own totals so batch and bench threads don't share counters. The monitor shows them
+and [perf] csv= in conundrum64.ini writes them out when the emulator exits.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include "emu.h"
+#include "cpu.h"
+#include "c64.h"
+#include "sysclock.h"
+#include "perf.h"
+
+#define PERF_CALIBRATE_NS		10000000ULL 	// least time to measure the counter over.
+#define PERF_OVERHEAD_READS		1000			// back to back reads to find the cost of one.
+
+typedef struct {
+
+	uint64_t 		ticks;
+	uint64_t 		ns;
+
+} PERF_CALIBRATION;
+
+PERF_CALIBRATION g_perfcalibration;
+pthread_once_t g_perfonce = PTHREAD_ONCE_INIT;
+uint64_t g_perfoverhead;
+
+const char * g_perfnames[PERF_SUBSYSTEMS] = {"cpu","mem","vicii","cia","vdrive","pacing","ux"};
+
+uint64_t perf_ns() {
+
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void perf_calibrate() {
+
+	uint64_t a;
+	uint64_t b;
+	int i;
+
+	g_perfoverhead = (uint64_t) -1;
+	for (i = 0; i < PERF_OVERHEAD_READS; i++) {
+		a = perf_now();
+		b = perf_now();
+		if (b - a < g_perfoverhead) {
+			g_perfoverhead = b - a;
+		}
+	}
+
+	g_perfcalibration.ticks = perf_now();
+	g_perfcalibration.ns 	= perf_ns();
+}
+
+//
+// the counter rate is measured against the monotonic clock from the first call on, so by 
+// the time anyone converts a run's totals it has had the whole run to settle.
+//
+double perf_tickspersecond() {
+
+	uint64_t ns;
+	uint64_t ticks;
+
+	pthread_once(&g_perfonce,perf_calibrate);
+
+	while ((ns = perf_ns()) - g_perfcalibration.ns < PERF_CALIBRATE_NS) {
+		usleep((PERF_CALIBRATE_NS - (ns - g_perfcalibration.ns)) / 1000 + 1);
+	}
+	ticks = perf_now();
+
+	return (double) (ticks - g_perfcalibration.ticks) * 1000000000.0 / (ns - g_perfcalibration.ns);
+}
+
+void perf_init() {
+
+	pthread_once(&g_perfonce,perf_calibrate);
+	C64_STATE(perf);
+	g_c64->perf->start 		= perf_now();
+	g_c64->perf->countdown 	= PERF_SAMPLE_PERIOD;
+}
+
+//
+// for work that is timed every time it happens rather than sampled.
+//
+void perf_charge(PERF_SUBSYSTEM s, uint64_t ticks) {
+
+	g_c64->perf->ticks[s] += ticks;
+	g_c64->perf->calls[s]++;
+
+	if (g_c64->perf->sampling) {
+		g_c64->perf->sampleCharged += ticks;
+	}
+}
+
+//
+// whatever wasn't charged directly is time the machine ran. each sampled subsystem gets the 
+// share of it that it had in the sampled updates. the rest of the run is the main loop and
+// sysclock bookkeeping, which perf_writecsv() reports as other.
+//
+void perf_get(PERF * out) {
+
+	uint64_t ran;
+	int s;
+
+	*out 		= *g_c64->perf;
+	out->at 	= perf_now();
+	out->cycles = sysclock_getticks();
+
+	ran = out->at - out->start;
+	for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+		ran -= ran > out->ticks[s] ? out->ticks[s] : ran;
+	}
+
+	for (s = 0; out->sampledTotal && s < PERF_SUBSYSTEMS; s++) {
+		out->ticks[s] += (uint64_t) ((double) out->sampled[s] / out->sampledTotal * ran);
+	}
+}
+
+const char * perf_name(PERF_SUBSYSTEM s) {
+	return g_perfnames[s];
+}
+
+//
+// one row per subsystem, then what no subsystem accounts for (the main loop, sysclock 
+// bookkeeping) and the run as a whole, whose count is emulated cycles. count and events are
+// kept apart, see PERF.
+//
+void perf_writecsv(const char * path, PERF * p) {
+
+	double rate 	= perf_tickspersecond();
+	double total 	= (p->at - p->start) / rate;
+	double other 	= total;
+	FILE * f;
+	int s;
+
+	if (!(f = fopen(path,"w"))) {
+		DEBUG_PRINT("Could not write perf csv %s.\n",path);
+		return;
+	}
+
+	fprintf(f,"subsystem,count,events,seconds,percent\n");
+	for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+		fprintf(f,"%s,%llu,%llu,%f,%f\n",g_perfnames[s],(unsigned long long) p->calls[s],
+			(unsigned long long) p->events[s],p->ticks[s] / rate,total > 0 ? p->ticks[s] / rate * 100 / total : 0);
+		other -= p->ticks[s] / rate;
+	}
+	fprintf(f,"other,,,%f,%f\n",other,total > 0 ? other * 100 / total : 0);
+	fprintf(f,"total,%lu,,%f,100\n",p->cycles,total);
+
+	fclose(f);
+}
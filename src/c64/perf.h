@@ -0,0 +1,194 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-------------------------------------------------------------------------------
+MODULE: perf.h
+Host time and emulated work attributed to each subsystem of the bound machine.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define PERF_SAMPLE_PERIOD		1009		// time one machine update in this many. prime, so 
+											// it doesn't beat against raster lines.
+
+typedef enum {
+
+	PERF_CPU,
+	PERF_MEM,						// memory map handlers: roms, io registers, cartridges.
+	PERF_VICII,
+	PERF_CIA,
+	PERF_VDRIVE,
+	PERF_PACING,					// waiting for real time when throttled.
+	PERF_UX,						// presenting the screen and monitor windows.
+	PERF_SUBSYSTEMS
+
+} PERF_SUBSYSTEM;
+
+//
+// calls is emulated cycles for the cpu (cycles it ran) and vicii (cycles it had the bus), 
+// handler calls for mem, cycles the drive answered the bus for vdrive, and waits or presents 
+// for pacing and ux. sysclock events (raster, timers, tod, journal flushes) are counted apart 
+// in events, against the subsystem they are charged to. ticks are perf_now() ticks, filled 
+// in by perf_get().
+//
+typedef struct _PERF {
+
+	uint64_t 		ticks[PERF_SUBSYSTEMS];
+	uint64_t 		calls[PERF_SUBSYSTEMS];
+	uint64_t 		events[PERF_SUBSYSTEMS];
+	uint64_t 		start;			// when the machine started.
+	uint64_t 		at;				// when perf_get() took this copy.
+	unsigned long 	cycles;			// sysclock ticks at that point.
+
+	uint64_t 		sampled[PERF_SUBSYSTEMS];	// ticks seen in sampled updates,
+	uint64_t 		sampledTotal;				// out of this long in them.
+	bool 			sampling;		// timing the current update.
+	unsigned int 	countdown;		// updates until the next sampled one.
+	uint64_t 		sampleStart;
+	uint64_t 		sampleCharged;	// charged directly during the sampled update.
+	unsigned int 	sampleReads;	// clock reads it made.
+	uint64_t 		nested;			// ticks already charged inside the current section.
+
+} PERF;
+
+//
+// the timestamp counter where there is one, otherwise nanoseconds. perf_tickspersecond()
+// converts either way.
+//
+static inline uint64_t perf_now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+}
+
+//
+// sections are short enough that reading the clock is a real part of them. each interval 
+// includes one read, which is taken back out along with whatever nested sections charged,
+// and a sampled update's length has all of its reads taken out.
+//
+extern uint64_t g_perfoverhead;
+
+static inline uint64_t perf_own(uint64_t elapsed, uint64_t nested) {
+	return elapsed > nested + g_perfoverhead ? elapsed - nested - g_perfoverhead : 0;
+}
+
+//
+// every update counts calls. one update in PERF_SAMPLE_PERIOD also reads the clock around
+// each section. reading the clock slows a sampled update down, so the samples only decide 
+// each subsystem's share of the time the machine ran, see perf_get(). pacing and ux are
+// timed whenever they happen and charged with perf_charge().
+//
+// PERF_SAMPLE() and PERF_SAMPLED() bracket an update. PERF_BEGIN() starts timing in a 
+// function, and each PERF_TIME() charges the time since the last mark to a subsystem and 
+// starts over. PERF_END() also counts a call and PERF_EVENT() an event. sections that can run inside another (memory handlers called from the cpu) 
+// use PERF_ENTER() and PERF_LEAVE() instead, and their time is taken back out of the 
+// enclosing section.
+//
+#define PERF_SAMPLE() do {													\
+		PERF * perf_p = g_c64->perf;										\
+		perf_p->nested = 0;													\
+		if ((perf_p->sampling = --perf_p->countdown == 0)) {				\
+			perf_p->countdown 		= PERF_SAMPLE_PERIOD;					\
+			perf_p->sampleCharged 	= 0;									\
+			perf_p->sampleReads 	= 1;									\
+			perf_p->sampleStart 	= perf_now();							\
+		}																	\
+	} while (0)
+
+#define PERF_SAMPLED() do {													\
+		PERF * perf_p = g_c64->perf;										\
+		if (perf_p->sampling) {												\
+			perf_p->sampledTotal += perf_own(perf_now() - perf_p->sampleStart,	\
+				perf_p->sampleCharged + perf_p->sampleReads * g_perfoverhead); \
+			perf_p->sampling = false;										\
+		}																	\
+	} while (0)
+
+#define PERF_BEGIN() 														\
+	uint64_t perf_mark = g_c64->perf->sampling ? (g_c64->perf->sampleReads++, perf_now()) : 0
+
+#define PERF_TIME(s) do {													\
+		PERF * perf_p = g_c64->perf;										\
+		if (perf_p->sampling) {												\
+			uint64_t perf_end = perf_now();									\
+			perf_p->sampleReads++;											\
+			perf_p->sampled[(s)] += perf_own(perf_end - perf_mark,perf_p->nested); \
+			perf_p->nested = 0;												\
+			perf_mark = perf_end;											\
+		}																	\
+	} while (0)
+
+#define PERF_COUNT(s) 	(g_c64->perf->calls[(s)]++)
+
+#define PERF_END(s) do {													\
+		PERF_COUNT(s);														\
+		PERF_TIME(s);														\
+	} while (0)
+
+#define PERF_EVENT(s) do {													\
+		g_c64->perf->events[(s)]++;											\
+		PERF_TIME(s);														\
+	} while (0)
+
+#define PERF_ENTER() 														\
+	uint64_t perf_outer = g_c64->perf->nested;								\
+	uint64_t perf_mark = g_c64->perf->sampling ? 							\
+		(g_c64->perf->nested = 0, g_c64->perf->sampleReads++, perf_now()) : 0
+
+#define PERF_LEAVE(s) do {													\
+		PERF * perf_p = g_c64->perf;										\
+		perf_p->calls[(s)]++;												\
+		if (perf_p->sampling) {												\
+			uint64_t perf_end = perf_now();									\
+			perf_p->sampleReads++;											\
+			perf_p->sampled[(s)] += perf_own(perf_end - perf_mark,perf_p->nested); \
+			perf_p->nested = perf_outer + perf_end - perf_mark + g_perfoverhead; \
+		}																	\
+	} while (0)
+
+void perf_init();
+void perf_charge(PERF_SUBSYSTEM s, uint64_t ticks);
+void perf_get(PERF * out);
+const char * perf_name(PERF_SUBSYSTEM s);
+double perf_tickspersecond();
+void perf_writecsv(const char * path, PERF * p);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: rewind.c
+Rewind buffer of recent machine states.
+
+Every [rewind] frames= video frames the chip state is copied into a ring of records, along
+with the RAM changes since the record before it. RAM changes are stored only for pages
+mem.c has marked dirty, as the XOR of the old and new page, run length encoded so the
+unchanged bytes cost next to nothing. A shadow copy of RAM at the newest record is what the
+XOR is taken against. Since XOR undoes itself, applying a record's delta to the shadow steps
+RAM back to the previous record.
+
+The oldest records are dropped to stay under [rewind] budget= bytes.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include "emu.h"
+#include "cpu.h"
+#include "mem.h"
+#include "sysclock.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "c64.h"
+
+
+#define REWIND_MAX_RECORDS		4096
+#define REWIND_DEFAULT_BUDGET	(16 * 1024 * 1024)
+#define REWIND_ZERO_RUN			0x80		// token bit: (n & 0x7F) + 1 unchanged bytes.
+#define REWIND_MAX_RUN			0x80
+#define REWIND_MAX_PAGE			(MEM_PAGE_SIZE + MEM_PAGE_SIZE / REWIND_MAX_RUN)	// page stored as plain literals.
+
+
+typedef struct {
+
+	unsigned long 	tick;			// sysclock tick the record was taken at.
+	byte * 			state;			// chip state from snapshot_capture, without ram.
+	byte * 			delta;			// [page][len lo][len hi][encoded xor]... against the previous record.
+	uint32_t 		deltasize;
+
+} REWIND_RECORD;
+
+typedef struct _REWIND {
+
+	unsigned int 	interval;		// frames between records.
+	unsigned int 	frames;			// frames since the last record.
+	unsigned long 	budget;			// bytes all records may use.
+	unsigned long 	bytes;
+
+	REWIND_RECORD 	records[REWIND_MAX_RECORDS];
+	int 			first;			// oldest record in the ring.
+	int 			count;
+
+	uint32_t 		statesize;
+	byte 			dirty;			// mem_dirtyregister() id.
+	byte 			shadow[MEM_SIZE];
+	byte 			scratch[MEM_PAGE_COUNT * (REWIND_MAX_PAGE + 3)];
+
+} REWIND;
+
+#define g_rewind 	(g_c64->rewind)
+
+
+REWIND_RECORD * rewind_record(int i) {
+	return &g_rewind->records[(g_rewind->first + i) % REWIND_MAX_RECORDS];
+}
+
+void rewind_free(REWIND_RECORD * r) {
+
+	g_rewind->bytes -= g_rewind->statesize + r->deltasize;
+	free(r->state);
+	free(r->delta);
+	r->state = NULL;
+	r->delta = NULL;
+	r->deltasize = 0;
+}
+
+void rewind_dropoldest() {
+
+	rewind_free(rewind_record(0));
+	g_rewind->first = (g_rewind->first + 1) % REWIND_MAX_RECORDS;
+	g_rewind->count--;
+
+	//
+	// the new oldest record is now the base. nothing before it to step back to.
+	//
+	if (g_rewind->count) {
+		g_rewind->bytes -= rewind_record(0)->deltasize;
+		free(rewind_record(0)->delta);
+		rewind_record(0)->delta = NULL;
+		rewind_record(0)->deltasize = 0;
+	}
+}
+
+uint32_t rewind_encodepage(byte * out, byte * ram, byte * shadow) {
+
+	byte * start = out;
+	byte * literal = NULL;
+	int i = 0;
+	int run;
+
+	//
+	// xor new against old. runs of zeros (unchanged bytes) become one token, everything
+	// else is copied as literals of up to 128 bytes.
+	//
+	while (i < MEM_PAGE_SIZE) {
+
+		//
+		// changed and unchanged bytes taking turns would cost more than the page itself.
+		// once that is where it is going, store the whole page as plain literals instead.
+		//
+		if (out - start + 2 > REWIND_MAX_PAGE) {
+			break;
+		}
+
+		for (run = 0; i + run < MEM_PAGE_SIZE && run < REWIND_MAX_RUN && ram[i + run] == shadow[i + run]; run++);
+
+		if (run) {
+			*out++ = REWIND_ZERO_RUN | (run - 1);
+			literal = NULL;
+			i += run;
+			continue;
+		}
+
+		if (!literal || *literal == REWIND_MAX_RUN - 1) {
+			literal = out++;
+			*literal = 0;
+		} else {
+			(*literal)++;
+		}
+		*out++ = ram[i] ^ shadow[i];
+		i++;
+	}
+
+	if (i < MEM_PAGE_SIZE) {
+		for (out = start, i = 0; i < MEM_PAGE_SIZE; i++) {
+			if (!(i % REWIND_MAX_RUN)) {
+				*out++ = REWIND_MAX_RUN - 1;
+			}
+			*out++ = ram[i] ^ shadow[i];
+		}
+	}
+
+	return out - start;
+}
+
+void rewind_applypage(byte * in, uint32_t len, byte * page) {
+
+	byte * end = in + len;
+	int i = 0;
+	int n;
+
+	while (in < end) {
+		n = (*in & ~REWIND_ZERO_RUN) + 1;
+		if (*in++ & REWIND_ZERO_RUN) {
+			i += n;
+		} else {
+			while (n--) {
+				page[i++] ^= *in++;
+			}
+		}
+	}
+}
+
+void rewind_applydelta(REWIND_RECORD * r) {
+
+	byte * ram = mem_getram();
+	byte * p = r->delta;
+	byte page;
+	uint32_t len;
+
+	//
+	// the delta takes the shadow (and ram, which matches it here) back to the previous record.
+	//
+	while (p < r->delta + r->deltasize) {
+		page = p[0];
+		len = p[1] | (p[2] << 8);
+		rewind_applypage(p + 3,len,g_rewind->shadow + page * MEM_PAGE_SIZE);
+		memcpy(ram + page * MEM_PAGE_SIZE,g_rewind->shadow + page * MEM_PAGE_SIZE,MEM_PAGE_SIZE);
+		p += 3 + len;
+	}
+}
+
+void rewind_capture() {
+
+	REWIND_RECORD * r;
+	byte * ram = mem_getram();
+	uint32_t size = 0;
+	uint32_t len;
+	int page;
+
+	if (g_rewind->count == REWIND_MAX_RECORDS) {
+		rewind_dropoldest();
+	}
+
+	//
+	// encode the pages written since the last record and bring the shadow up to date.
+	//
+	for (page = 0; page < MEM_PAGE_COUNT; page++) {
+
+		if (!mem_pagedirty(g_rewind->dirty,page) || 
+			!memcmp(ram + page * MEM_PAGE_SIZE,g_rewind->shadow + page * MEM_PAGE_SIZE,MEM_PAGE_SIZE)) {
+			continue;
+		}
+
+		len = rewind_encodepage(g_rewind->scratch + size + 3,ram + page * MEM_PAGE_SIZE,
+			g_rewind->shadow + page * MEM_PAGE_SIZE);
+		g_rewind->scratch[size] 	= page;
+		g_rewind->scratch[size + 1] = len & 0xFF;
+		g_rewind->scratch[size + 2] = len >> 8;
+		size += len + 3;
+
+		memcpy(g_rewind->shadow + page * MEM_PAGE_SIZE,ram + page * MEM_PAGE_SIZE,MEM_PAGE_SIZE);
+	}
+	mem_cleardirty(g_rewind->dirty);
+
+	r = rewind_record(g_rewind->count);
+	r->tick 		= sysclock_getticks();
+	r->state 		= (byte *) malloc(g_rewind->statesize);
+	r->delta 		= (g_rewind->count && size) ? (byte *) malloc(size) : NULL;
+	r->deltasize 	= r->delta ? size : 0;
+
+	if (!r->state || (g_rewind->count && size && !r->delta)) {
+		free(r->state);
+		free(r->delta);
+		r->state = r->delta = NULL;
+		rewind_reset();
+		return;
+	}
+
+	snapshot_capture(r->state,"RAM ");
+	if (r->delta) {
+		memcpy(r->delta,g_rewind->scratch,size);
+	}
+	g_rewind->count++;
+	g_rewind->bytes += g_rewind->statesize + r->deltasize;
+
+	while (g_rewind->bytes > g_rewind->budget && g_rewind->count > 1) {
+		rewind_dropoldest();
+	}
+}
+
+void rewind_frame() {
+
+	if (g_rewind && ++g_rewind->frames >= g_rewind->interval) {
+		g_rewind->frames = 0;
+		rewind_capture();
+	}
+}
+
+bool rewind_back() {
+
+	REWIND_RECORD * r;
+	byte * ram = mem_getram();
+	int page;
+
+	if (!g_rewind || !g_rewind->count) {
+		return false;
+	}
+
+	//
+	// already sitting on the newest record, so step back over it. nowhere to go from the oldest.
+	//
+	r = rewind_record(g_rewind->count - 1);
+	if (r->tick == sysclock_getticks()) {
+		if (g_rewind->count == 1) {
+			return false;
+		}
+		for (page = 0; page < MEM_PAGE_COUNT; page++) {
+			if (mem_pagedirty(g_rewind->dirty,page)) {
+				memcpy(ram + page * MEM_PAGE_SIZE,g_rewind->shadow + page * MEM_PAGE_SIZE,MEM_PAGE_SIZE);
+			}
+		}
+		rewind_applydelta(r);
+		rewind_free(r);
+		g_rewind->count--;
+		r = rewind_record(g_rewind->count - 1);
+	}
+
+	//
+	// ram written since the record is put back from the shadow.
+	//
+	for (page = 0; page < MEM_PAGE_COUNT; page++) {
+		if (mem_pagedirty(g_rewind->dirty,page)) {
+			memcpy(ram + page * MEM_PAGE_SIZE,g_rewind->shadow + page * MEM_PAGE_SIZE,MEM_PAGE_SIZE);
+		}
+	}
+	mem_cleardirty(g_rewind->dirty);
+
+	snapshot_restore(r->state,"RAM ");
+	g_rewind->frames = 0;
+
+	DEBUG_PRINT("Rewind: back to tick %lu (%d records, %lu bytes).\n",r->tick,g_rewind->count,g_rewind->bytes);
+	return true;
+}
+
+void rewind_reset() {
+
+	if (!g_rewind) {
+		return;
+	}
+
+	while (g_rewind->count) {
+		rewind_dropoldest();
+	}
+	g_rewind->first 	= 0;
+	g_rewind->frames 	= 0;
+	g_rewind->bytes 	= 0;
+
+	//
+	// the next record is the new base, taken against the whole of ram.
+	//
+	memcpy(g_rewind->shadow,mem_getram(),MEM_SIZE);
+	mem_cleardirty(g_rewind->dirty);
+}
+
+void rewind_init() {
+
+	EMU_CONFIGURATION * cfg = emu_getconfig();
+
+	rewind_destroy();
+
+	if (!cfg->rewindframes || !atoi(cfg->rewindframes)) {
+		return;
+	}
+
+	if (!(g_rewind = (REWIND *) calloc(1,sizeof(REWIND)))) {
+		FATAL_ERROR("%s: out of memory for the rewind buffer.\n",emu_getname());
+	}
+
+	g_rewind->interval 	= atoi(cfg->rewindframes);
+	g_rewind->budget 	= cfg->rewindbudget ? strtoul(cfg->rewindbudget,NULL,10) : REWIND_DEFAULT_BUDGET;
+	g_rewind->statesize = snapshot_capture(NULL,"RAM ");
+	g_rewind->dirty 	= mem_dirtyregister(false);
+	rewind_reset();
+
+	DEBUG_PRINT("Rewind: every %u frames, %lu byte budget.\n",g_rewind->interval,g_rewind->budget);
+}
+
+void rewind_destroy() {
+
+	if (g_rewind) {
+		rewind_reset();
+		free(g_rewind);
+		g_rewind = NULL;
+	}
+}
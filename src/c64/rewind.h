@@ -0,0 +1,52 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: rewind.h
+Rewind buffer of recent machine states.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef REWIND_H
+#define REWIND_H
+
+void rewind_init();
+void rewind_destroy();
+void rewind_reset();
+void rewind_frame();
+bool rewind_back();
+
+//
+// page delta coding, exposed for the tests in test.c. encodepage writes at most
+// MEM_PAGE_SIZE + MEM_PAGE_SIZE / 128 bytes.
+//
+uint32_t rewind_encodepage(byte * out, byte * ram, byte * shadow);
+void rewind_applypage(byte * in, uint32_t len, byte * page);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: snapshot.c
+Machine save states.
+
+File layout (host byte order, only meant to be read back by the same build):
+
+	SNAPSHOT_HEADER
+	SNAPSHOT_CHUNK, state bytes, padding to 8 bytes
+	...
+
+A chunk is loaded only if its id, version and size match what the chip registered, and
+the whole file is checked before anything is copied so a bad file leaves the machine alone.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+	BUGBUG: disk and cartridge contents are not saved. the same disk and cartridge must be
+	inserted when the state is loaded.
+
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "emu.h"
+#include "cpu.h"
+#include "snapshot.h"
+#include "c64.h"
+
+
+#define SNAPSHOT_MAGIC			"C64SNAP"
+#define SNAPSHOT_VERSION		1
+#define SNAPSHOT_MAX_CHUNKS		16
+#define SNAPSHOT_ALIGN(n)		(((n) + 7) & ~7)
+
+
+typedef struct {
+
+	char 		magic[8];
+	uint32_t 	version;
+	uint32_t 	chunks;
+
+} SNAPSHOT_HEADER;
+
+typedef struct {
+
+	char 		id[4];
+	uint32_t 	version;
+	uint32_t 	size;
+	uint32_t 	reserved;
+
+} SNAPSHOT_CHUNK;
+
+typedef struct {
+
+	char 					id[4];
+	word 					version;
+	void * 					state;
+	uint32_t 				size;
+	SNAPSHOT_LOADHANDLER 	fn;
+
+} SNAPSHOT_ENTRY;
+
+typedef struct _SNAPSHOT {
+
+	SNAPSHOT_ENTRY 	entries[SNAPSHOT_MAX_CHUNKS];
+	byte 			entryNext;
+
+} SNAPSHOT;
+
+#define g_snapshot 	(*g_c64->snapshot)
+
+
+void snapshot_register(const char * id, word version, void * state, uint32_t size, SNAPSHOT_LOADHANDLER fn) {
+
+	SNAPSHOT_ENTRY * e;
+	byte i;
+
+	C64_STATE(snapshot);
+
+	//
+	// chips registering again (the machine was reinitialized) replace their old entry.
+	//
+	for (i = 0; i < g_snapshot.entryNext && memcmp(g_snapshot.entries[i].id,id,4); i++);
+
+	if (i == SNAPSHOT_MAX_CHUNKS) {
+		FATAL_ERROR("Snapshot: Out of snapshot chunk space.\n");
+	}
+	if (i == g_snapshot.entryNext) {
+		g_snapshot.entryNext++;
+	}
+
+	e = &g_snapshot.entries[i];
+	memcpy(e->id,id,4);
+	e->version 	= version;
+	e->state 	= state;
+	e->size 	= size;
+	e->fn 		= fn;
+}
+
+bool snapshot_save(const char * path) {
+
+	SNAPSHOT_HEADER * h;
+	SNAPSHOT_CHUNK * c;
+	SNAPSHOT_ENTRY * e;
+	size_t size = sizeof(SNAPSHOT_HEADER);
+	byte * buf;
+	byte * p;
+	bool ok;
+	FILE * f;
+	byte i;
+
+	for (i = 0; i < g_snapshot.entryNext; i++) {
+		size += sizeof(SNAPSHOT_CHUNK) + SNAPSHOT_ALIGN(g_snapshot.entries[i].size);
+	}
+
+	if (!(buf = (byte *) calloc(1,size))) {
+		return false;
+	}
+
+	//
+	// build the whole file in memory so it goes out in one write.
+	//
+	h = (SNAPSHOT_HEADER *) buf;
+	memcpy(h->magic,SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC));
+	h->version 	= SNAPSHOT_VERSION;
+	h->chunks 	= g_snapshot.entryNext;
+	p = buf + sizeof(SNAPSHOT_HEADER);
+
+	for (i = 0; i < g_snapshot.entryNext; i++) {
+		e = &g_snapshot.entries[i];
+		c = (SNAPSHOT_CHUNK *) p;
+		memcpy(c->id,e->id,4);
+		c->version 	= e->version;
+		c->size 	= e->size;
+		memcpy(p + sizeof(SNAPSHOT_CHUNK),e->state,e->size);
+		p += sizeof(SNAPSHOT_CHUNK) + SNAPSHOT_ALIGN(e->size);
+	}
+
+	ok = (f = fopen(path,"wb")) != NULL;
+	if (ok) {
+		ok = fwrite(buf,1,size,f) == size;
+		ok = (fclose(f) == 0) && ok;
+	}
+	free(buf);
+
+	DEBUG_PRINT("Snapshot: %s %s (%lu bytes).\n",ok ? "saved" : "failed to save",path,(unsigned long) size);
+	return ok;
+}
+
+uint32_t snapshot_capture(byte * out, const char * except) {
+
+	SNAPSHOT_ENTRY * e;
+	uint32_t size = 0;
+	byte i;
+
+	for (i = 0; i < g_snapshot.entryNext; i++) {
+		e = &g_snapshot.entries[i];
+		if (except && !memcmp(e->id,except,4)) {
+			continue;
+		}
+		if (out) {
+			memcpy(out + size,e->state,e->size);
+		}
+		size += e->size;
+	}
+	return size;
+}
+
+void snapshot_restore(byte * in, const char * except) {
+
+	SNAPSHOT_ENTRY * e;
+	byte i;
+
+	for (i = 0; i < g_snapshot.entryNext; i++) {
+		e = &g_snapshot.entries[i];
+		if (except && !memcmp(e->id,except,4)) {
+			continue;
+		}
+		if (e->fn) {
+			e->fn(e->state,in);
+		} else {
+			memcpy(e->state,in,e->size);
+		}
+		in += e->size;
+	}
+}
+
+SNAPSHOT_CHUNK * snapshot_findchunk(byte * image, size_t size, SNAPSHOT_ENTRY * e) {
+
+	SNAPSHOT_HEADER * h = (SNAPSHOT_HEADER *) image;
+	SNAPSHOT_CHUNK * c;
+	byte * p = image + sizeof(SNAPSHOT_HEADER);
+	uint32_t i;
+
+	for (i = 0; i < h->chunks && p + sizeof(SNAPSHOT_CHUNK) <= image + size; i++) {
+		c = (SNAPSHOT_CHUNK *) p;
+		if (p + sizeof(SNAPSHOT_CHUNK) + c->size > image + size) {
+			return NULL;
+		}
+		if (!memcmp(c->id,e->id,4)) {
+			return (c->version == e->version && c->size == e->size) ? c : NULL;
+		}
+		p += sizeof(SNAPSHOT_CHUNK) + SNAPSHOT_ALIGN(c->size);
+	}
+	return NULL;
+}
+
+bool snapshot_load(const char * path) {
+
+	SNAPSHOT_HEADER * h;
+	SNAPSHOT_CHUNK * chunks[SNAPSHOT_MAX_CHUNKS];
+	SNAPSHOT_ENTRY * e;
+	struct stat st;
+	byte * image;
+	bool ok = true;
+	int fd;
+	byte i;
+
+	if ((fd = open(path,O_RDONLY)) < 0) {
+		DEBUG_PRINT("Snapshot: failed to open %s.\n",path);
+		return false;
+	}
+	if (fstat(fd,&st) != 0 || st.st_size < sizeof(SNAPSHOT_HEADER) ||
+		(image = (byte *) mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED) {
+		close(fd);
+		DEBUG_PRINT("Snapshot: failed to map %s.\n",path);
+		return false;
+	}
+	close(fd);
+
+	//
+	// check everything first. every registered chip must find a matching chunk.
+	//
+	h = (SNAPSHOT_HEADER *) image;
+	if (memcmp(h->magic,SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC)) || h->version != SNAPSHOT_VERSION) {
+		ok = false;
+	}
+	for (i = 0; ok && i < g_snapshot.entryNext; i++) {
+		if (!(chunks[i] = snapshot_findchunk(image,st.st_size,&g_snapshot.entries[i]))) {
+			DEBUG_PRINT("Snapshot: %s has no usable %.4s chunk.\n",path,g_snapshot.entries[i].id);
+			ok = false;
+		}
+	}
+
+	for (i = 0; ok && i < g_snapshot.entryNext; i++) {
+		e = &g_snapshot.entries[i];
+		if (e->fn) {
+			e->fn(e->state,(byte *) (chunks[i] + 1));
+		} else {
+			memcpy(e->state,chunks[i] + 1,e->size);
+		}
+	}
+
+	munmap(image,st.st_size);
+	DEBUG_PRINT("Snapshot: %s %s.\n",ok ? "loaded" : "failed to load",path);
+
+	return ok;
+}
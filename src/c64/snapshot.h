@@ -0,0 +1,59 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: snapshot.h
+Machine save states.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#define SNAPSHOT_DEFAULT_PATH	"conundrum64.snap"
+
+//
+// each chip registers its state once at init. a save writes every registered block as a 
+// chunk, a load copies chunks back. chips with pointers in their state pass a load handler 
+// that keeps them, otherwise the chunk is copied straight over the state.
+//
+typedef void (*SNAPSHOT_LOADHANDLER)(void * state, byte * data);
+
+void snapshot_register(const char * id, word version, void * state, uint32_t size, SNAPSHOT_LOADHANDLER fn);
+bool snapshot_save(const char * path);
+bool snapshot_load(const char * path);
+
+//
+// in memory copies for the same run, skipping one chunk id (eg "RAM ") or none if NULL.
+// capture returns the bytes needed and only writes when out is not NULL.
+//
+uint32_t snapshot_capture(byte * out, const char * except);
+void snapshot_restore(byte * in, const char * except);
+
+#endif
@@ -38,11 +38,26 @@ KNOWN BUGS:
 #include <time.h>
 #include "cpu.h"
 #include "sysclock.h"
+#include "snapshot.h"
+#include "perf.h"
+#include "c64.h"
 
 #define SYSCLOCK_CATCHUP 20000
+#define SYSCLOCK_MAX_EVENTS 16 // arbitrary
+
 
 typedef struct {
 
+	SYSCLOCK_EVENTHANDLER fn;		// called when the event fires.
+	void * 		  data;				// passed to fn.
+	PERF_SUBSYSTEM perf;			// charged with the time fn takes.
+	unsigned long tick;				// tick at which the event fires.
+	bool 		  active;			// event is scheduled.
+
+} SYSCLOCK_EVENT;
+
+typedef struct _SYSCLOCK {
+
 	unsigned long total;			// total systicks
 	word 		  clast;			// systicks since last catchup
 	clock_t		  clastreal;		// time at last refresh
@@ -51,18 +66,49 @@ typedef struct {
 									// NTSC and PAL
 
 	bool		  phi;				// true == high false == low 
+
+	SYSCLOCK_EVENT events[SYSCLOCK_MAX_EVENTS];
+	byte 		  eventNext;
+	unsigned long nextevent;		// tick of the earliest scheduled event.
+	bool 		  unthrottled;		// run as fast as the host allows.
 } SYSCLOCK;
 
-SYSCLOCK g_sysclock = {0};
+#define g_sysclock 	(*g_c64->sysclock)
+
+void sysclock_loadstate(void * state, byte * data) {
+
+	SYSCLOCK * s = (SYSCLOCK *) data;
+	byte i;
+
+	//
+	// handlers stay as registered, only the schedule is restored. the real time reference
+	// starts over so throttling doesn't try to catch up.
+	//
+	g_sysclock.total 		= s->total;
+	g_sysclock.clast 		= 0;
+	g_sysclock.clastreal 	= clock();
+	g_sysclock.lastadd 		= s->lastadd;
+	g_sysclock.phi 			= s->phi;
+	g_sysclock.nextevent 	= s->nextevent;
+
+	for (i = 0; i < g_sysclock.eventNext && i < s->eventNext; i++) {
+		g_sysclock.events[i].tick 	= s->events[i].tick;
+		g_sysclock.events[i].active = s->events[i].active;
+	}
+}
 
 void sysclock_init(void) {
 
 	EMU_CONFIGURATION * cfg = emu_getconfig();
 	DEBUG_PRINT("** Initializing System Clock...\n");
 
+	C64_STATE(sysclock);
 	g_sysclock.total 			= 0;
 	g_sysclock.clast 			= 0;
 	g_sysclock.clastreal		= clock();
+	g_sysclock.eventNext		= 0;
+	g_sysclock.nextevent		= SYSCLOCK_NEVER;
+	snapshot_register("CLK ",1,&g_sysclock,sizeof(SYSCLOCK),sysclock_loadstate);
 
 	if (cfg->region && !strcmp(cfg->region,"PAL")) {
 		g_sysclock.tickspersec = PAL_TICKS_PER_SECOND;
@@ -90,18 +136,83 @@ bool sysclock_getphi() {
 	return g_sysclock.phi;
 }
 
+byte sysclock_addevent(SYSCLOCK_EVENTHANDLER fn, void * data, PERF_SUBSYSTEM perf) {
+
+	if (g_sysclock.eventNext == SYSCLOCK_MAX_EVENTS) {
+		FATAL_ERROR("System Clock: Out of event space.\n");
+	}
+
+	g_sysclock.events[g_sysclock.eventNext].fn = fn;
+	g_sysclock.events[g_sysclock.eventNext].data = data;
+	g_sysclock.events[g_sysclock.eventNext].perf = perf;
+	g_sysclock.events[g_sysclock.eventNext].active = false;
+
+	return g_sysclock.eventNext++;
+}
+
+void sysclock_updatenextevent() {
+
+	int i;
+
+	g_sysclock.nextevent = SYSCLOCK_NEVER;
+
+	for (i = 0; i < g_sysclock.eventNext; i++) {
+		if (g_sysclock.events[i].active && g_sysclock.events[i].tick < g_sysclock.nextevent) {
+			g_sysclock.nextevent = g_sysclock.events[i].tick;
+		}
+	}
+}
+
+void sysclock_scheduleevent(byte id, unsigned long tick) {
+
+	g_sysclock.events[id].tick = tick;
+	g_sysclock.events[id].active = true;
+	sysclock_updatenextevent();
+}
+
+void sysclock_cancelevent(byte id) {
+
+	g_sysclock.events[id].active = false;
+	sysclock_updatenextevent();
+}
+
+void sysclock_runevents() {
+
+	int i;
+	PERF_BEGIN();
+
+	for (i = 0; i < g_sysclock.eventNext; i++) {
+		if (g_sysclock.events[i].active && g_sysclock.events[i].tick <= g_sysclock.total) {
+			//
+			// handlers are free to reschedule themselves.
+			//
+			g_sysclock.events[i].active = false;
+			g_sysclock.events[i].fn(g_sysclock.events[i].data);
+			PERF_EVENT(g_sysclock.events[i].perf);
+		}
+	}
+
+	sysclock_updatenextevent();
+}
+
 void sysclock_update() {
 
 
 	clock_t c;
+	uint64_t wait;
 
 	if(!g_sysclock.phi) {
 		g_sysclock.total++;
 		g_sysclock.clast++;
+
+		if (g_sysclock.total >= g_sysclock.nextevent) {
+			sysclock_runevents();
+		}
 	}
 
 
-	if (g_sysclock.clast > SYSCLOCK_CATCHUP) {
+	if (g_sysclock.clast > SYSCLOCK_CATCHUP && !g_sysclock.unthrottled) {
+		wait = perf_now();
 		//
 		// wait for real clock to catchup.
 		//
@@ -112,12 +223,19 @@ void sysclock_update() {
 
 		g_sysclock.clastreal = c;
 		g_sysclock.clast = 0;
+		perf_charge(PERF_PACING,perf_now() - wait);
 	}
 
 	g_sysclock.phi = !g_sysclock.phi;
 
 }
 
+void sysclock_setthrottle(bool throttle) {
+	g_sysclock.unthrottled 	= !throttle;
+	g_sysclock.clast 		= 0;
+	g_sysclock.clastreal 	= clock();
+}
+
 double sysclock_getelapsedseconds(void) {
 	return (double) g_sysclock.total / g_sysclock.tickspersec;
 }
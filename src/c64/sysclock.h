@@ -34,6 +34,8 @@ KNOWN BUGS:
 #ifndef SYSCLOCK_H
 #define SYSCLOCK_H
 
+#include "perf.h"
+
 
 
 /*
@@ -59,15 +61,30 @@ KNOWN BUGS:
 #define PHI_HIGH	true
 #define PHI_LOW		false
 
+#define SYSCLOCK_NEVER	((unsigned long) -1)
+
+
+//
+// events let components ask to be called back at a future tick instead of polling every cycle.
+// register once with sysclock_addevent() then (re)schedule or cancel using the returned id.
+//
+typedef void (*SYSCLOCK_EVENTHANDLER)(void * data);
+
 
 bool sysclock_isPALfrequency();
 bool sysclock_isNTSCfrequency();
 void sysclock_init(void);
 void sysclock_update(void);
+void sysclock_setthrottle(bool throttle);	// false runs unthrottled, for headless use.
 bool sysclock_getphi(void);
 unsigned long sysclock_gettickspersec(void);
 word sysclock_getlastaddticks(void);
 double sysclock_getelapsedseconds(void);
+unsigned long sysclock_getticks(void);
+
+byte sysclock_addevent(SYSCLOCK_EVENTHANDLER fn, void * data, PERF_SUBSYSTEM perf);
+void sysclock_scheduleevent(byte id, unsigned long tick);
+void sysclock_cancelevent(byte id);
 
 
 
@@ -73,6 +73,7 @@ B0-B2 are unused by the bus
 command nibbles:
 0x10 				Rx Byte: Listener should prepare to receive a byte.
 0x20				Tx Byte: Listener should prepare to send a byte.
+0x30				Burst: Listener fills the $DF00 window with the next block of the open file.
 
 
 Bus idle state: CPU in control, no active operations, ATTN is clear.
@@ -105,6 +106,18 @@ Cpu Receive Byte Sequence:
 		CPU [AB = 0]												// acknowledge
 (Bus Idle)
 
+Cpu Burst Block Sequence:
+
+(Bus Idle)
+
+	CPU [AB = 1] [DATA = 0x30]										// burst command
+		Drive fills $DF00 window									// $DF00 count (0 = end of file)
+																	// $DF01-$DFFF up to 255 bytes
+		Drive [AB = 0]												// acknowledge
+	CPU copies the window
+
+(Bus Idle)
+
 
 */
 
@@ -112,17 +125,60 @@ Cpu Receive Byte Sequence:
 #include "vdrive.h"
 #include "cpu.h"
 #include "d64.h"
+#include "mem.h"
+#include "snapshot.h"
+#include "c64.h"
 
 
 #define VDRIVE_ATTN_BIT  		0x08
 #define VDRIVE_DATA_MASK        0xF0
 #define VDRIVE_RX_BYTE          0x10
 #define VDRIVE_TX_BYTE          0x20
+#define VDRIVE_BURST            0x30
+#define VDRIVE_WINDOW_SIZE		0x100
 #define VDRIVE_BUS_BITS         (VDRIVE_ATTN_BIT | VDRIVE_DATA_MASK)
 
 
 #define CIA2_SERIAL_BUS 0xDD00
 
+//
+// KERNAL load entry (after LOAD has saved the address in $C3/$C4) and the zero page 
+// variables it uses.
+//
+#define VDRIVE_KERNAL_LOAD		0xF4A5
+#define VDRIVE_KERNAL_LOAD_OP	0x85		// STA $93 
+#define VDRIVE_DEVICE			8
+#define VDRIVE_ZP_STATUS		0x90
+#define VDRIVE_ZP_VERIFY		0x93
+#define VDRIVE_ZP_ENDADDR		0xAE
+#define VDRIVE_ZP_NAMELEN		0xB7
+#define VDRIVE_ZP_SECONDARY		0xB9
+#define VDRIVE_ZP_DEVICE		0xBA
+#define VDRIVE_ZP_NAMEPTR		0xBB
+#define VDRIVE_ZP_LOADADDR		0xC3
+#define VDRIVE_STATUS_EOI		0x40
+#define VDRIVE_STATUS_VERIFY	0x10
+#define VDRIVE_STATUS_NOTFOUND	0x42
+#define VDRIVE_ERR_NOTFOUND		0x04
+#define VDRIVE_KERNAL_SAVE		0xF5ED
+#define VDRIVE_KERNAL_SAVE_OP	0xA5		// LDA $BA
+#define VDRIVE_ZP_SAVEADDR		0xC1
+#define VDRIVE_ERR_NODEVICE		0x05
+#define VDRIVE_NOTREADY_CYCLES	1000		// wait before retrying a load that is still prefetching.
+
+//
+// burst loader patched over the (unsupported) tape read routines. see asm/burstload.asm
+//
+#define VDRIVE_BURST_LOADER		0xF92C
+
+typedef enum {
+
+	VDRIVE_LOAD_SERIAL,				// KERNAL talks to the drive over the bus.
+	VDRIVE_LOAD_TRAP,				// LOAD is trapped and files are copied straight to ram.
+	VDRIVE_LOAD_BURST				// LOAD is trapped and the file streams through the window.
+
+} VDRIVE_LOADMODE;
+
 typedef enum {
 
 	VDRIVE_STATE_IDLE,
@@ -135,7 +191,7 @@ typedef enum {
 
 
 
-typedef struct {
+typedef struct _VDRIVE {
 
 	VDRIVE_STATE state;				// current drive state.
 	byte rx;						// the byte being received. 
@@ -144,9 +200,17 @@ typedef struct {
 
 	FILE * disk;					// currently inserted disk.
 
+	VDRIVE_LOADMODE loadmode;		// how KERNAL LOAD reaches the drive.
+	word fastloadcycles;			// cycles charged for each fast load.
+
+	D64_FILE channel;				// file open for burst transfers.
+	unsigned long channelpos;		// next byte of channel to send.
+	bool channelopen;
+	byte window[VDRIVE_WINDOW_SIZE];// shared buffer mapped at $DF00.
+
 } VDRIVE;
 
-VDRIVE g_vdrive = {0};
+#define g_vdrive 	(*g_c64->vdrive)
 
 
 
@@ -254,6 +318,16 @@ byte g_vdrive_kpatch_11[] = {
 	0xB3,0xEE,0x60
 };
 
+//
+// burst loader. asm/burstload.asm
+//
+byte g_vdrive_kpatch_burst[] = {
+	0x2C, 0xF9, 0x78, 0xA9, 0x38, 0x20, 0x8B, 0xED, 0xAE, 0x00, 0xDF, 0xF0, 0x18, 0xA0, 
+	0x00, 0xB9, 0x01, 0xDF, 0x91, 0xAE, 0xC8, 0xCA, 0xD0, 0xF7, 0x98, 0x18, 0x65, 0xAE, 
+	0x85, 0xAE, 0x90, 0xE3, 0xE6, 0xAF, 0x4C, 0x2D, 0xF9, 0xA9, 0x40, 0x85, 0x90, 0x58, 
+	0xA6, 0xAE, 0xA4, 0xAF, 0x18, 0x60
+};
+
 
 
 void vdrive_writebus(byte b) {mem_poke (CIA2_SERIAL_BUS,(mem_peek(CIA2_SERIAL_BUS) & ~VDRIVE_BUS_BITS) | b);}
@@ -263,14 +337,216 @@ void vdrive_set_attention() {mem_poke(CIA2_SERIAL_BUS,mem_peek(CIA2_SERIAL_BUS)
 
 void vdrive_clear_attention() {mem_poke(CIA2_SERIAL_BUS,mem_peek(CIA2_SERIAL_BUS) & ~VDRIVE_ATTN_BIT);}
 
+byte vdrive_windowpeek(word address) 			{return g_vdrive.window[address];}
+void vdrive_windowpoke(word address,byte val) 	{g_vdrive.window[address] = val;}
+
+void vdrive_closechannel() {
+
+	if (g_vdrive.channelopen) {
+		d64_close_file(&g_vdrive.channel);
+		g_vdrive.channelopen = false;
+	}
+}
+
+void vdrive_burst() {
+
+	unsigned long count = 0;
+
+	//
+	// next block of the open file into the window. a zero count marks the end.
+	//
+	if (g_vdrive.channelopen) {
+		count = g_vdrive.channel.size - g_vdrive.channelpos;
+		if (count > VDRIVE_WINDOW_SIZE - 1) {
+			count = VDRIVE_WINDOW_SIZE - 1;
+		}
+		memcpy(g_vdrive.window + 1,g_vdrive.channel.data + g_vdrive.channelpos,count);
+		g_vdrive.channelpos += count;
+	}
+
+	g_vdrive.window[0] = count;
+	if (count == 0) {
+		vdrive_closechannel();
+	}
+}
+
+
+
+
+
+
+bool vdrive_fastload() {
+
+	D64_FILE f;
+	char name[256];
+	byte len = mem_peek(VDRIVE_ZP_NAMELEN);
+	word nameptr = mem_peekword(VDRIVE_ZP_NAMEPTR);
+	bool verify = cpu_geta() != 0;
+	bool found;
+	word address;
+	word end;
+	unsigned long i;
+
+	//
+	// only our device, and leave missing names to the KERNAL error path.
+	//
+	if (mem_peek(VDRIVE_ZP_DEVICE) != VDRIVE_DEVICE || len == 0) {
+		return false;
+	}
+
+	for (i = 0; i < len; i++) {
+		name[i] = mem_peek(nameptr + i);
+	}
+	name[len] = 0;
+
+	//
+	// the disk may still be reading ahead on the host. run the trap again later
+	// rather than wait on it.
+	//
+	if (!d64_file_ready(name)) {
+		cpu_setpc(VDRIVE_KERNAL_LOAD);
+		cpu_addcycles(VDRIVE_NOTREADY_CYCLES);
+		return true;
+	}
+
+	mem_poke(VDRIVE_ZP_VERIFY,cpu_geta());
+
+	//
+	// a file without a load address is no use either, but it still has to be given back.
+	//
+	found = d64_open_file(&f,name);
+	if (found && f.size < 2) {
+		d64_close_file(&f);
+		found = false;
+	}
+
+	if (!found) {
+		DEBUG_PRINT("Vdrive fast load: %s not found.\n",name);
+		mem_poke(VDRIVE_ZP_STATUS,VDRIVE_STATUS_NOTFOUND);
+		cpu_seta(VDRIVE_ERR_NOTFOUND);
+		cpu_setstatus(cpu_getstatus() | C_FLAG);
+		cpu_rts();
+		return true;
+	}
+
+	//
+	// secondary address 0 relocates to the address passed to LOAD, otherwise use the file's.
+	//
+	address = mem_peek(VDRIVE_ZP_SECONDARY) ? (f.data[0] | (f.data[1] << 8)) : mem_peekword(VDRIVE_ZP_LOADADDR);
+	DEBUG_PRINT("Vdrive fast load: %s (%lu bytes) at %04X.\n",name,f.size - 2,address);
+
+	//
+	// in burst mode hand the file to the loader in rom, which pulls it over the bus.
+	//
+	if (g_vdrive.loadmode == VDRIVE_LOAD_BURST && !verify) {
+		vdrive_closechannel();
+		g_vdrive.channel 		= f;
+		g_vdrive.channelpos 	= 2;
+		g_vdrive.channelopen 	= true;
+		mem_pokeword(VDRIVE_ZP_ENDADDR,address);
+		mem_poke(VDRIVE_ZP_STATUS,0);
+		cpu_setpc(VDRIVE_BURST_LOADER);
+		return true;
+	}
+
+	mem_poke(VDRIVE_ZP_STATUS,VDRIVE_STATUS_EOI);
+
+	//
+	// straight into ram, as if the bytes had come from the drive.
+	// BUGBUG: loads over $D000-$DFFF land in ram under i/o.
+	//
+	end = address + f.size - 2;
+	if (!verify) {
+		mem_load_block(address,f.data + 2,f.size - 2,MEM_TARGET_RAM);
+	} else {
+		for (i = 2; i < f.size; i++) {
+			if (mem_peek(address + i - 2) != f.data[i]) {
+				mem_poke(VDRIVE_ZP_STATUS,mem_peek(VDRIVE_ZP_STATUS) | VDRIVE_STATUS_VERIFY);
+			}
+		}
+	}
+	d64_close_file(&f);
+
+	mem_pokeword(VDRIVE_ZP_ENDADDR,end);
+	cpu_setx(end & 0xFF);
+	cpu_sety(end >> 8);
+	cpu_setstatus(cpu_getstatus() & ~C_FLAG);
+	cpu_addcycles(g_vdrive.fastloadcycles);
+	cpu_rts();
+
+	return true;
+}
 
+bool vdrive_fastsave() {
 
+	char name[256];
+	byte data[0x10002];
+	byte len = mem_peek(VDRIVE_ZP_NAMELEN);
+	word nameptr = mem_peekword(VDRIVE_ZP_NAMEPTR);
+	word start = mem_peekword(VDRIVE_ZP_SAVEADDR);
+	word end = mem_peekword(VDRIVE_ZP_ENDADDR);
+	unsigned long size = 2;
+	unsigned long i;
+	int err;
 
+	if (mem_peek(VDRIVE_ZP_DEVICE) != VDRIVE_DEVICE || len == 0) {
+		return false;
+	}
+
+	for (i = 0; i < len; i++) {
+		name[i] = mem_peek(nameptr + i);
+	}
+	name[len] = 0;
+
+	//
+	// the file is the load address followed by start..end-1. it goes into the disk's write
+	// journal, the host file is only touched later when the journal flushes.
+	//
+	data[0] = start & 0xFF;
+	data[1] = start >> 8;
+	for (i = start; i < end; i++) {
+		data[size++] = mem_peek(i);
+	}
 
+	err = d64_save_file(name,data,size);
+	DEBUG_PRINT("Vdrive fast save: %s (%lu bytes) from %04X. result %d.\n",name,size - 2,start,err);
+
+	if (err == D64_ERR_NODISK) {
+		cpu_seta(VDRIVE_ERR_NODEVICE);
+		cpu_setstatus(cpu_getstatus() | C_FLAG);
+	} else {
+		cpu_setstatus(cpu_getstatus() & ~C_FLAG);
+	}
+	mem_poke(VDRIVE_ZP_STATUS,0);
+	cpu_addcycles(g_vdrive.fastloadcycles);
+	cpu_rts();
+
+	return true;
+}
+
+void vdrive_loadstate(void * state, byte * data) {
+
+	VDRIVE * v = (VDRIVE *) data;
+
+	//
+	// only the bus state comes back. the disk stays as configured, and a burst transfer
+	// that was open when the state was saved is dropped.
+	//
+	vdrive_closechannel();
+	g_vdrive.state 	= v->state;
+	g_vdrive.rx 	= v->rx;
+	g_vdrive.tx 	= v->tx;
+	memcpy(g_vdrive.window,v->window,sizeof(g_vdrive.window));
+}
 
 void vdrive_init() {
 
+	EMU_CONFIGURATION * cfg = emu_getconfig();
+	byte trap[] = {VDRIVE_KERNAL_LOAD & 0xFF, VDRIVE_KERNAL_LOAD >> 8, CPU_TRAP_OPCODE};
+	byte savetrap[] = {VDRIVE_KERNAL_SAVE & 0xFF, VDRIVE_KERNAL_SAVE >> 8, CPU_TRAP_OPCODE};
+
 	DEBUG_PRINT("** Initializing virtual drive.\n");
+	C64_STATE(vdrive);
 	c64_patch_kernal(sizeof(g_vdrive_kpatch_1),g_vdrive_kpatch_1);
 	c64_patch_kernal(sizeof(g_vdrive_kpatch_2),g_vdrive_kpatch_2);
 	c64_patch_kernal(sizeof(g_vdrive_kpatch_3),g_vdrive_kpatch_3);
@@ -284,6 +560,25 @@ void vdrive_init() {
 	c64_patch_kernal(sizeof(g_vdrive_kpatch_11),g_vdrive_kpatch_11);
 	g_vdrive.state = VDRIVE_STATE_IDLE;
 
+	g_vdrive.loadmode = VDRIVE_LOAD_SERIAL;
+	if (cfg->fastload && !strcmp(cfg->fastload,"trap")) {
+		g_vdrive.loadmode = VDRIVE_LOAD_TRAP;
+	} else if (cfg->fastload && !strcmp(cfg->fastload,"burst")) {
+		g_vdrive.loadmode = VDRIVE_LOAD_BURST;
+		c64_patch_kernal(sizeof(g_vdrive_kpatch_burst),g_vdrive_kpatch_burst);
+	}
+
+	g_vdrive.fastloadcycles = cfg->fastloadcycles ? strtoul(cfg->fastloadcycles,NULL,10) : 0;
+	if (g_vdrive.loadmode != VDRIVE_LOAD_SERIAL) {
+		DEBUG_PRINT("Vdrive fast load enabled (%s).\n",cfg->fastload);
+		c64_patch_kernal(sizeof(trap),trap);
+		cpu_addtrap(VDRIVE_KERNAL_LOAD,VDRIVE_KERNAL_LOAD_OP,vdrive_fastload);
+		c64_patch_kernal(sizeof(savetrap),savetrap);
+		cpu_addtrap(VDRIVE_KERNAL_SAVE,VDRIVE_KERNAL_SAVE_OP,vdrive_fastsave);
+	}
+
+	snapshot_register("VDRV",1,&g_vdrive,sizeof(VDRIVE),vdrive_loadstate);
+
 	//
 	// c64_create_patch_array("asm/kpbusv2.prg");
 	// printf("******\n");
@@ -293,9 +588,24 @@ void vdrive_init() {
 
 }
 
-void vdrive_update() {
+void vdrive_destroy() {
+
+	//
+	// flushes any pending disk writes. the disk is shared, so only the machine that 
+	// inserted it takes it out.
+	//
+	if (d64_inserted()) {
+		d64_eject_disk();
+	}
+}
+
+//
+// true when the drive answered the bus this cycle, rather than just looking at it.
+//
+bool vdrive_update() {
 
 	byte b = vdrive_readbus();
+	bool served = false;
 
 	switch(g_vdrive.state) {
 
@@ -304,6 +614,12 @@ void vdrive_update() {
 				DEBUG_PRINT("Vdrive was idle, but commanded to receive a byte.\n");
 				vdrive_clear_attention();
 				g_vdrive.state = VDRIVE_STATE_RX0;
+				served = true;
+			}
+			else if (b == (VDRIVE_ATTN_BIT | VDRIVE_BURST)) {
+				vdrive_burst();
+				vdrive_clear_attention();
+				served = true;
 			}
 		break;
 		case VDRIVE_STATE_RX0:
@@ -311,6 +627,7 @@ void vdrive_update() {
 				g_vdrive.rx = b >> 4;
 				g_vdrive.state = VDRIVE_STATE_RX1;
 				vdrive_clear_attention();
+				served = true;
 			}
 		break;
 		case VDRIVE_STATE_RX1:
@@ -319,9 +636,12 @@ void vdrive_update() {
 				DEBUG_PRINT("Vdrive received byte 0x%02X (%c)\n",g_vdrive.rx,g_vdrive.rx);
 				g_vdrive.state = VDRIVE_STATE_IDLE;
 				vdrive_clear_attention();
+				served = true;
 			}
 		break;
 	}
+
+	return served;
 }
 
 
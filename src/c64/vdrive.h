@@ -36,7 +36,17 @@ KNOWN BUGS:
 #ifndef VDRIVE_H
 #define VDRIVE_H
 
+#include "emu.h"
+#include "cpu.h"
+
 void vdrive_init();
-void vdrive_update();
+bool vdrive_update();
+void vdrive_destroy();
+
+//
+// burst transfer window, mapped at $DF00 with i/o.
+//
+byte vdrive_windowpeek(word address);
+void vdrive_windowpoke(word address,byte val);
 
 #endif VDRIVE_H
\ No newline at end of file
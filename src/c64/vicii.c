@@ -38,6 +38,8 @@ KNOWN BUGS:
 #include "cpu.h"
 #include "vicii.h"
 #include "sysclock.h"
+#include "snapshot.h"
+#include "c64.h"
 
 
 
@@ -106,6 +108,28 @@ KNOWN BUGS:
 
 #define VICII_COLOR_MEM_BASE			0xD800
 
+//
+// BA schedule. Which cycles of a raster line the VIC needs the bus for is worked out at the start of 
+// the line, and again in cycle 56 once sprite DMA for the end of the line is known. 
+//
+#define VICII_BA_CYCLE(c)					(((uint64_t) 1) << ((c) - 1))
+#define VICII_BA_BADLINE_FIRST				12
+#define VICII_BA_BADLINE_LAST				55
+#define VICII_BA_SPRITE_LEADIN				3		// BA goes low three cycles before the first s-access.
+#define VICII_BA_SPRITE_SCHEDULE_CYCLE		56
+
+//
+// cycle of the p-access for each sprite. s-accesses follow in this cycle and the next. The 
+// NTSC chips fit their extra cycles in before sprite 0, so sprites 0-2 come later in the line.
+//
+const byte g_vicii_sprite_pcycle_pal[8] 	= {58,60,62,1,3,5,7,9};		// 6569, 63 cycles.
+const byte g_vicii_sprite_pcycle_ntsc[8] 	= {60,62,64,1,3,5,7,9};		// 6567R8, 65 cycles.
+const byte g_vicii_sprite_pcycle_ntscold[8] = {59,61,63,1,3,5,7,9};		// 6567R56A, 64 cycles.
+
+#define VICII_CYCLES_NTSC					65
+#define VICII_CYCLES_NTSCOLD				64
+#define VICII_LAST_SPRITE_EARLY				2		// sprites 0-2 are fetched at the end of the line.
+
 /*
 	RGB values of C64 colors from 
 	http://unusedino.de/ec64/technical/misc/vic656x/colors/
@@ -266,20 +290,24 @@ typedef struct {
 } VICII_SPRITE;
 
 
-typedef struct {
+typedef struct _VICII {
 
 	byte regs[0x30];				// note some reg read/writes fall through to 
 									// member variables below. 
 	VICII_SPRITE sprites[8];		// per sprite data.
 	VICII_VIDEODATA data[40];		// copied during badlines.
 	
-	word raster_y;					// raster Y position -- CPU can get this through registers.
+	word raster_y;					// raster Y position -- VIC internal beam position used for drawing.
 	word raster_irq;				// raster irq compare -- CPU can set this through registers.
 	word raster_x;					// raster x position  -- VIC internal only. 
+	long framestart;				// sysclock tick at which raster line 0 started. CPU reads of the raster
+									// position are derived from this.
+	byte rasterevent;				// sysclock event id for the raster irq.
 
 	bool hblank; 					// are we in horizontal blanking?
 	bool badline;					// Vic needs extra cycles to fetch data during this line. 
-	bool balow;						// BAlow stuns the CPU on badline situations.
+	uint64_t bamask;				// BA low schedule for this line. bit n set means cycle n+1 is stolen
+									// from the CPU (badline c-accesses and sprite s-accesses).
 	bool den;						// is display enabled? 
 	bool idle; 						// idle or display state. 
 
@@ -313,6 +341,8 @@ typedef struct {
 	bool  displayline;				// if true, we are outside of vblanking lines.
 
 	byte cycle;						// internal cycle count per line.
+	byte cyclesperline;				// varies by NTSC and PAL. How many cycles in a raster line?
+	const byte * spritepcycle;		// sprite p-access cycles for this chip.
 
 	//
 	// the current bitmap frame.
@@ -345,18 +375,35 @@ typedef struct {
 
 } VICII;
 
-VICII g_vic = {0};
+#define g_vic 	(*g_c64->vic)
 
+void vicii_rasterevent(void * data);
+void vicii_scheduleraster();
 
 
-bool vicii_stuncpu() 			{return g_vic.balow;}
+
+bool vicii_stuncpu() 			{return g_vic.cycle && (g_vic.bamask & VICII_BA_CYCLE(g_vic.cycle));}
 word vicii_getscreenheight() 	{return g_vic.screenheight;}
 word vicii_getscreenwidth() 	{return g_vic.screenwidth;}
 
+void vicii_loadstate(void * state, byte * data) {
+
+	uint32_t ** out = g_vic.out;
+	byte ** type = g_vic.type;
+
+	//
+	// the frame buffers stay, the next frame redraws them.
+	//
+	memcpy(&g_vic,data,sizeof(VICII));
+	g_vic.out 	= out;
+	g_vic.type 	= type;
+}
+
 void vicii_init() {
 
 	DEBUG_PRINT("** Initializing VICII...\n");
 
+	C64_STATE(vic);
 	g_vic.screenwidth = VICII_FRAMEBUFFER_WIDTH;
 
 	if (sysclock_isNTSCfrequency()) {
@@ -384,6 +431,10 @@ void vicii_init() {
 		g_vic.lastvisibleraster			= VICII_RASTER_Y_LAST_VISIBLE_LINE_PAL;
 	}
 
+	g_vic.cyclesperline = g_vic.raster_x_overflow / 8;
+	g_vic.spritepcycle 	= g_vic.cyclesperline == VICII_CYCLES_NTSC ? g_vicii_sprite_pcycle_ntsc :
+		g_vic.cyclesperline == VICII_CYCLES_NTSCOLD ? g_vicii_sprite_pcycle_ntscold : g_vicii_sprite_pcycle_pal;
+
 	g_vic.out = malloc(sizeof(uint32_t *)*g_vic.screenheight);
 	g_vic.type = malloc(sizeof(byte *)*g_vic.screenheight);
 
@@ -392,7 +443,7 @@ void vicii_init() {
 	}
 	for (int i = 0 ; i < g_vic.screenheight; i++) {
 
-		g_vic.out[i] = malloc(sizeof(uint32_t) * g_vic.screenwidth);
+		g_vic.out[i] = calloc(g_vic.screenwidth,sizeof(uint32_t));
 		g_vic.type[i] = malloc(sizeof(byte) * g_vic.screenwidth);
 		if(!g_vic.out[i] || !g_vic.type[i]) {
 			FATAL_ERROR("Fatal error initializing emulator graphics.\n");
@@ -402,6 +453,13 @@ void vicii_init() {
 
 	g_vic.raster_x = g_vic.linestart_x; 
 
+	//
+	// the first line drawn is line 1, starting on tick 1.
+	//
+	g_vic.framestart = 1 - (long) g_vic.cyclesperline;
+	g_vic.rasterevent = sysclock_addevent(vicii_rasterevent,NULL,PERF_VICII);
+	vicii_scheduleraster();
+
 
 	g_vic.displaytop 		= VICII_25ROW_TOP;
 	g_vic.displaybottom 	= VICII_25ROW_BOTTOM;
@@ -411,6 +469,8 @@ void vicii_init() {
 	if (!g_vic.out || !g_vic.type) {
 		FATAL_ERROR("Fatal error intiailizing emulator graphics..\n");
 	}
+
+	snapshot_register("VIC ",1,&g_vic,sizeof(VICII),vicii_loadstate);
 }
 
 
@@ -449,6 +509,57 @@ void vicii_destroy() {
 } 
 
 bool vicii_frameready() {return g_vic.frameready;}
+unsigned int vicii_getframes() {return g_vic.frames;}
+
+//
+// raster line as seen by the CPU, computed from the system clock. A new line becomes visible 
+// on the cycle after the VIC starts it.
+//
+word vicii_getrastery() {
+
+	long elapsed = (long) sysclock_getticks() - 1 - g_vic.framestart;
+	return (word) ((elapsed / g_vic.cyclesperline) % g_vic.rasterlines);
+}
+
+//
+// work out the next tick at which the raster compare matches and schedule the raster event for 
+// it. Called whenever the compare value or irq enable changes, and after each raster irq.
+//
+void vicii_scheduleraster() {
+
+	long now = (long) sysclock_getticks();
+	long framelength = (long) g_vic.rasterlines * g_vic.cyclesperline;
+	long tick;
+
+	if (g_vic.raster_irq >= g_vic.rasterlines) {
+		//
+		// compare value is never reached.
+		//
+		sysclock_cancelevent(g_vic.rasterevent);
+		return;
+	}
+
+	tick = g_vic.framestart + (long) g_vic.raster_irq * g_vic.cyclesperline + 1;
+	while (tick <= now) {
+		tick += framelength;
+	}
+
+	sysclock_scheduleevent(g_vic.rasterevent,(unsigned long) tick);
+}
+
+void vicii_rasterevent(void * data) {
+
+	//
+	// BUGBUG: not sure this gets cleared. 
+	//
+	g_vic.regs[VICII_ISR] |= VICII_ICR_RASTER_INTERRUPT;
+	if (g_vic.regs[VICII_ICR] & VICII_ICR_RASTER_INTERRUPT) {
+		DEBUG_PRINT("VICII is signalling raster irq.\n");
+		cpu_irq();
+	}
+
+	vicii_scheduleraster();
+}
 
 void vicii_updateraster() {
 
@@ -473,17 +584,7 @@ void vicii_updateraster() {
 		
 		if (g_vic.raster_y == g_vic.rasterlines) {					//  End of screen, wrap to raster 0. 
 			g_vic.raster_y = 0;
-		}
-
-		if (g_vic.raster_irq == g_vic.raster_y) {					// Check for Raster IRQ
-			//
-			// BUGBUG: not sure this gets cleared. 
-			//
-			g_vic.regs[VICII_ISR] |= VICII_ICR_RASTER_INTERRUPT;
-			if (g_vic.regs[VICII_ICR] & VICII_ICR_RASTER_INTERRUPT) {
-				DEBUG_PRINT("VICII is signalling raster irq.\n");
-				cpu_irq();
-			}
+			g_vic.framestart = (long) sysclock_getticks();
 		}
 	}
 }
@@ -1024,10 +1125,143 @@ void vicii_checkborderflipflops() {
 
 
 
+//
+// mark cycles first through last of this line as BA low. Cycles outside of the line are dropped, sprites
+// that pull BA low at the end of the previous line are scheduled in cycle 56 of that line.
+//
+void vicii_setbarange(int first, int last) {
+
+	int c;
+
+	for (c = first; c <= last; c++) {
+		if (c >= 1 && c <= g_vic.cyclesperline) {
+			g_vic.bamask |= VICII_BA_CYCLE(c);
+		}
+	}
+}
+
+//
+// build the BA schedule at the start of a raster line. Covers badline c-accesses and s-accesses for 
+// sprites 3-7, whose DMA state was settled in cycles 55 and 56 of the previous line.
+//
+void vicii_schedulelineba() {
+
+	int i;
+	int p;
+
+	g_vic.bamask = 0;
+
+	if (g_vic.badline) {
+		vicii_setbarange(VICII_BA_BADLINE_FIRST,VICII_BA_BADLINE_LAST);
+	}
+
+	for (i = 0; i < 8; i++) {
+		p = g_vic.spritepcycle[i];
+		if (g_vic.sprites[i].dma && p < VICII_BA_SPRITE_SCHEDULE_CYCLE) {
+			vicii_setbarange(p - VICII_BA_SPRITE_LEADIN,p + 1);
+		}
+	}
+}
+
+//
+// add sprite s-accesses for the end of the line once DMA has been checked in cycles 55 and 56. This
+// includes the lead in for sprites fetched at the start of the next line.
+//
+void vicii_schedulespriteba() {
+
+	int i;
+	int p;
+
+	for (i = 0; i < 8; i++) {
+
+		if (!g_vic.sprites[i].dma) {
+			continue;
+		}
+
+		p = g_vic.spritepcycle[i];
+		if (p < VICII_BA_SPRITE_SCHEDULE_CYCLE) {
+			p += g_vic.cyclesperline;
+		}
+		vicii_setbarange(p - VICII_BA_SPRITE_LEADIN,p + 1);
+	}
+}
+
+//
+// how many cycles, starting with the current one, the CPU can run before the VIC steals the bus. Stops
+// at the next point where the schedule is rebuilt so the caller never runs past a change.
+//
+word vicii_getfreecycles() {
+
+	byte end;
+	byte next;
+	uint64_t pending;
+
+	if (g_vic.cycle == 0) {
+		return 1;
+	}
+
+	end = g_vic.cycle < VICII_BA_SPRITE_SCHEDULE_CYCLE ? 
+		VICII_BA_SPRITE_SCHEDULE_CYCLE : g_vic.cyclesperline + 1;
+
+	pending = g_vic.bamask >> (g_vic.cycle - 1);
+	next = pending ? g_vic.cycle + __builtin_ctzll(pending) : end;
+
+	return (next < end ? next : end) - g_vic.cycle;
+}
+
+//
+// p- and s-accesses of the sprites fetched at the end of the line, in whichever cycles this
+// chip fetches them.
+//
+void vicii_spritefetch() {
+
+	int i;
+
+	for (i = 0; i <= VICII_LAST_SPRITE_EARLY; i++) {
+		if (g_vic.cycle == g_vic.spritepcycle[i]) {
+			vicii_paccess(i);
+			vicii_saccess(i);
+		} else if (g_vic.cycle == g_vic.spritepcycle[i] + 1) {
+			vicii_saccess(i);
+			vicii_saccess(i);
+		}
+	}
+}
+
+//
+// the badline condition is checked in every cycle of the line, so a YSCROLL (or DEN) write
+// can start or end one part way through. rebuild the BA schedule while c-accesses can still
+// happen; past that the end of line sprite schedule has taken over.
+//
+void vicii_checkbadline() {
+
+	bool badline;
+
+	if (g_vic.raster_y == 0x30 && (g_vic.regs[VICII_CR1] & BIT_4)) {
+		g_vic.den = true;
+	}
+
+	if (g_vic.cycle < 1 || g_vic.cycle >= VICII_BA_BADLINE_LAST) {
+		return;
+	}
+
+	badline = g_vic.den && g_vic.raster_y >= 0x30 && g_vic.raster_y <= 0xF7 && 
+		(g_vic.raster_y & 0x7) == (g_vic.regs[VICII_CR1] & 0x7);
+
+	if (badline != g_vic.badline) {
+		g_vic.badline = badline;
+		if (badline) {
+			g_vic.idle = false;
+		}
+		vicii_schedulelineba();
+		c64_bachanged();
+	}
+}
+
 void vicii_update_phihigh() {
 
 	
-	if (g_vic.cycle >= 16 && g_vic.cycle <= 55) {	
+	if (g_vic.badline && g_vic.cycle >= 16 && g_vic.cycle <= 55) {	
 		vicii_caccess();
 	}
 }
@@ -1077,6 +1311,9 @@ void vicii_update_philow() {
 			if (g_vic.badline) {
 				g_vic.idle = false;
 			}
+
+			vicii_schedulelineba();
+
 			vicii_paccess(3);
 			vicii_saccess(3);
 		break;
@@ -1121,11 +1358,8 @@ void vicii_update_philow() {
 		break;
 		case 11:
 		break;
-		// * Set BA Low if BadLine 
+		// * BA goes low here on a badline (see vicii_schedulelineba)
 		case 12: 
-			if (g_vic.badline) {
-				g_vic.balow = true;
-			} 
 		break;
 		case 13:
 			
@@ -1168,7 +1402,6 @@ void vicii_update_philow() {
 			vicii_gaccess();
 			
 		break;
-		// * turn off balow because of badline.
 		case 55:
 			
 			vicii_gaccess();	
@@ -1189,12 +1422,12 @@ void vicii_update_philow() {
 		break;
 		// * turn on border in 38 column mode.
 		case 56: 
-			g_vic.balow = false;
 			vicii_gaccess();
 			
 			
 				
 			vicii_checkspritesdmaon();
+			vicii_schedulespriteba();
 		break;
 		// * turn on border in 40 column mode.
 		case 57:
@@ -1211,35 +1444,17 @@ void vicii_update_philow() {
 				g_vic.rc = (g_vic.rc + 1) & 0x7;
 			}
 			vicii_checkspriteson();
-			vicii_paccess(0);
-			vicii_saccess(0);
+			vicii_spritefetch();
 
 		break;
-		case 59:
-			vicii_saccess(0);
-			vicii_saccess(0);
-		break;
 		case 60: 
 			vicii_drawsprites();
-			vicii_paccess(1);
-			vicii_saccess(1);
-		break;
-		case 61: 
-			vicii_saccess(1);
-			vicii_saccess(1);
-		break;
-		case 62: 
-			vicii_paccess(2);
-			vicii_saccess(2);
-		break;
-		// * turn on border. 
-		case 63:
-			vicii_saccess(2);
-			vicii_saccess(2);
-		break;
-		case 64: 
+			vicii_spritefetch();
 		break;
-		case 65: 
+		// * p- and s-accesses of sprites 0-2. which cycle fetches what depends on the 
+		//   chip, see vicii_spritefetch().
+		case 59: case 61: case 62: case 63: case 64: case 65:
+			vicii_spritefetch();
 		break;
 		default: 
 		break;
@@ -1287,10 +1502,10 @@ byte vicii_peek(word address) {
 	byte rval;
 	switch(reg) {
 		case VICII_RASTER: 
-			rval = g_vic.raster_y & 0xFF; 
+			rval = vicii_getrastery() & 0xFF; 
 		break;
 		case VICII_CR1:
-			rval = g_vic.regs[VICII_CR1] | ((g_vic.raster_y & 0x100) >> 1);
+			rval = (g_vic.regs[VICII_CR1] & ~BIT_7) | ((vicii_getrastery() & 0x100) >> 1);
 		break;
 		case VICII_CR2: 
 			// B7 and B6 not connected.
@@ -1355,6 +1570,8 @@ void vicii_poke(word address,byte val) {
 			g_vic.regs[reg] = val;
 			// latch bit 7. Its part of the irq raster compare. 
 			g_vic.raster_irq = (g_vic.raster_irq & 0xFF) | (((word) val & BIT_7)<<1) ;
+			vicii_scheduleraster();
+			vicii_checkbadline();
 			// set the vertical screen height
 			if (val & BIT_3) {
 				DEBUG_PRINT("\tScreen Height is 1\n");
@@ -1404,6 +1621,7 @@ void vicii_poke(word address,byte val) {
 		break;
 		case VICII_RASTER: // latch raster line irq compare.
 			g_vic.raster_irq = (g_vic.raster_irq & 0x0100) | val; 
+			vicii_scheduleraster();
 			DEBUG_PRINT("VICII Raster IRQ Set to raster line %d\n",g_vic.raster_irq);
 		break;
 
@@ -1437,6 +1655,7 @@ void vicii_poke(word address,byte val) {
 
 		case VICII_ICR:
 			g_vic.regs[reg] = val;
+			vicii_scheduleraster();
 			DEBUG_PRINT("VICII Interrupt Control Register updated.\n");
 			DEBUG_PRINT("%-40s [%sABLED]\n","\tRaster Interrupt:",val & BIT_0 ? "EN":"DIS");
 			DEBUG_PRINT("%-40s [%sABLED]\n","\tSprite-Background Interrupt:",val & BIT_1 ? "EN":"DIS");
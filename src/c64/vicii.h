@@ -44,6 +44,10 @@ void vicii_setbank();
 byte vicii_peek(word address);
 void vicii_poke(word address,byte val);
 bool vicii_badline();
+bool vicii_stuncpu();
+word vicii_getfreecycles();
+bool vicii_frameready();
+unsigned int vicii_getframes();
 
 
 word vicii_getscreenheight();
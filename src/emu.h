@@ -37,6 +37,8 @@ KNOWN BUGS:
 
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -56,12 +58,24 @@ typedef struct {
     const char*     region;
     const char*     disk;
     const char*     program;
+    const char*     diskcache;      // byte budget for decoded disk files.
+    const char*     fastload;       // "trap" to load files without the serial bus.
+    const char*     fastloadcycles; // cycles to charge for a fast load.
+    const char*     rewindframes;   // frames between rewind records. unset is off.
+    const char*     rewindbudget;   // bytes the rewind buffer may use.
+    const char*     perfcsv;        // where to write subsystem accounting on exit.
+    const char*     profilelabels;  // guest profiler: labels to name routines with,
+    const char*     profileroutines;// and where to write its outputs on exit.
+    const char*     profilepcs;
+    const char*     profilefolded;
     uint16_t  breakpoint;
 
 } EMU_CONFIGURATION;
 
 
 EMU_CONFIGURATION * emu_getconfig();
+void emu_init();
+void emu_destroy();
 
 
 
@@ -84,8 +98,8 @@ EMU_CONFIGURATION * emu_getconfig();
 
 #if defined(DEBUG) && DEBUG > 0
 
-	FILE * 	g_debug;
-	clock_t g_debugstart;
+	extern FILE * 	g_debug;
+	extern clock_t g_debugstart;
 
 	char * emu_getname();
 
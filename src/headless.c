@@ -0,0 +1,118 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-------------------------------------------------------------------------------
+MODULE: headless.c
+	con64-headless: the emulator without SDL, for scripts and CI. Built with 
+	"make headless" from src/c64, src/inih and the batch runner; nothing in src/ux.
+
+	con64-headless [options]
+		--frames N				stop after N frames (default 600). 0 means no frame limit.
+		--cycles N				stop after N cpu cycles.
+		--program file.prg		load a PRG once BASIC is ready.
+		--basic file.bas		tokenize a BASIC listing into memory once BASIC is ready.
+		--disk file.d64			insert a disk. with --program, the file to load from it.
+		--cart file.crt			plug in a cartridge before reset.
+		--type FRAME:TEXT		type TEXT and RETURN, FRAME frames after BASIC is ready.
+		--until ADDR=VAL		stop once ram at ADDR holds VAL (hex). exits 2 if it never does.
+		--ram LOW-HIGH			dump a range of ram (hex). may repeat.
+		--hashevery N			with --json, record a frame hash every N frames.
+		--routines file.csv		profile the 6502 code, cycles per routine.
+		--pcs file.csv			... per address.
+		--folded file			... as folded stacks for flamegraph.pl or speedscope.
+		--labels file			VICE or ACME labels to name routines with.
+		--screen				print the text screen.
+		--json					print a json line, as --batch does, instead of text.
+		--batch manifest [out]	run a batch manifest, see batch.c.
+
+	exits 0 when the run finished, 1 when a file couldn't be loaded and 2 when --until
+	was never met.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "emu.h"
+#include "batch.h"
+
+
+void headless_usage() {
+	fprintf(stderr,"%s\n"
+		"usage: con64-headless [--frames N] [--cycles N] [--program file.prg] [--basic file.bas]\n"
+		"                      [--disk file.d64] [--cart file.crt] [--type FRAME:TEXT]\n"
+		"                      [--until ADDR=VAL] [--ram LOW-HIGH] [--hashevery N]\n"
+		"                      [--routines file] [--pcs file] [--folded file] [--labels file]\n"
+		"                      [--screen] [--json]\n"
+		"       con64-headless --batch manifest [results]\n",emu_getname());
+}
+
+
+int main(int argc, char**argv) {
+
+	BATCH_JOB job;
+	int rc;
+	int i;
+
+	emu_init();
+
+	if (argc > 2 && !strcmp(argv[1],"--batch")) {
+		rc = batch_run(argv[2],argc > 3 ? argv[3] : BATCH_DEFAULT_RESULTS);
+		emu_destroy();
+		return rc;
+	}
+
+	batch_initjob(&job,"headless");
+	job.text = true;
+
+	for (i = 1; i < argc; i++) {
+
+		if (!strcmp(argv[i],"--screen")) {
+			job.screen = true;
+		} else if (!strcmp(argv[i],"--json")) {
+			job.text = false;
+		} else if (strncmp(argv[i],"--",2) || i + 1 >= argc || !batch_setjob(&job,argv[i] + 2,argv[i + 1])) {
+			headless_usage();
+			emu_destroy();
+			return BATCH_FAILED;
+		} else {
+			i++;
+		}
+	}
+
+	rc = batch_runjob(&job,0,stdout);
+
+	if (emu_getconfig()->perfcsv) {
+		perf_writecsv(emu_getconfig()->perfcsv,&job.perf);
+	}
+
+	emu_destroy();
+	return rc;
+}
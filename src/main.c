@@ -37,100 +37,38 @@ KNOWN BUGS:
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#include "ini.h"
 
 #include "emu.h"
+#include "batch.h"
+#include "perf.h"
 
 #include <time.h>
 
 
-EMU_CONFIGURATION g_config = {0};
-char g_nameString[255];
-char * emu_getname() {return g_nameString;}
-
-
-EMU_CONFIGURATION * emu_getconfig() {
-	return &g_config;
-}
-
-
-static int config_handler(
-	void* configdata, const char* section, const char* name, const char* value) {
-
-#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-
-	EMU_CONFIGURATION * c = (EMU_CONFIGURATION *) configdata;
-
-	if (MATCH("roms", "kernal")) {
-        
-        c->kernalpath = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tKernal rom Path:",c->kernalpath);
-
-    } else if (MATCH("roms", "char")) {
-        
-        c->charpath = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tChar rom path:",c->charpath);
-
-    } else if (MATCH("roms", "basic")) {
-        
-        c->basicpath = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tBasic rom path:",c->basicpath);
-    
-    } else if (MATCH("bin", "load")) {
-    
-        c->binload = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tBinary load:",c->binload);
-    
-    }  else if (MATCH("bin", "loadcart")) {
-    
-        c->cartload = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tLoad cartridge:",c->cartload);
-    
-    }  else if (MATCH("debug", "breakpoint")) {
-    
-        c->breakpoint = strtoul(value,NULL,16);
-        DEBUG_PRINT("%-40s [%s]\n","\tInitial breakpoint:",c->breakpoint);
-    
-    }  else if (MATCH("system", "region")) {
-   
-        c->region = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tRegion:",c->region);
-   
-    } else if (MATCH("disk", "disk")) {
-   
-        c->disk = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tDisk to insert:",c->disk);
-   
-    } else if (MATCH("disk", "program")) {
-   
-        c->program = strdup(value);
-        DEBUG_PRINT("%-40s [%s]\n","\tProgram to load:",c->program);
-   
-    } else {
-        return 0;  
-    }
-
-    return 1;
-}
-
-
+int main(int argc, char**argv) {
 
+    EMU_CONFIGURATION * cfg;
+    PERF perf;
 
-int main(int argc, char**argv) {
+    emu_init();
+    cfg = emu_getconfig();
 
-    sprintf(g_nameString,"%s (version %d.%d)",EMU_NAME,EMU_VERSION_MAJOR,EMU_VERSION_MINOR);
-    time_t start = time(NULL);
-	DEBUG_INIT("c64.log");
-    DEBUG_PRINT("Local time: %s",asctime(localtime(&start)));
-		
-    DEBUG_PRINT("Reading configuration file.\n");
-    if (ini_parse("conundrum64.ini", config_handler, &g_config) < 0) {
-        DEBUG_PRINT("Failed to load initialization file 'conundrum64.ini'\n");
+    //
+    // con64 --batch manifest [results] runs the manifest's jobs without a window and exits.
+    //
+    if (argc > 2 && !strcmp(argv[1],"--batch")) {
+        int rc = batch_run(argv[2],argc > 3 ? argv[3] : BATCH_DEFAULT_RESULTS);
+        emu_destroy();
+        return rc;
     }
 
 	c64_init();
 	ux_init();
 
+    if (cfg->profileroutines || cfg->profilepcs || cfg->profilefolded) {
+        cpu_profilestart(cfg->profilelabels);
+    }
+
 
 	ux_startemulator();
 	
@@ -142,9 +80,15 @@ int main(int argc, char**argv) {
 
 	} while (!ux_done());
 
+    if (cfg->perfcsv) {
+        perf_get(&perf);
+        perf_writecsv(cfg->perfcsv,&perf);
+    }
+    cpu_profilesave(cfg->profileroutines,cfg->profilepcs,cfg->profilefolded);
+
 	c64_destroy();
 	ux_destroy();
 
-	DEBUG_DESTROY();
+	emu_destroy();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+/*
+Conundrum 64: Commodore 64 Emulator
+
+MIT License
+
+Copyright (c) 2017 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-------------------------------------------------------------------------------
+MODULE: test.c
+	con64-test: checks of emulator pieces that can be exercised without ROMs. Built and run
+	with "make test"; exits 0 when every check passes and 1 otherwise.
+
+	con64-test [name]
+
+	With a name only that check runs.
+
+WORK ITEMS:
+
+KNOWN BUGS:
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "emu.h"
+#include "cpu.h"
+#include "mem.h"
+#include "rewind.h"
+
+typedef struct {
+
+	const char * 	name;
+	bool 			(*fn)();
+
+} TEST;
+
+//
+// a delta page must never outgrow the rewind scratch buffer, whatever ram did.
+//
+bool test_rewindpage(const char * what, byte * ram, byte * shadow) {
+
+	byte out[MEM_PAGE_SIZE * 2];
+	byte page[MEM_PAGE_SIZE];
+	uint32_t len;
+
+	len = rewind_encodepage(out,ram,shadow);
+	if (len > MEM_PAGE_SIZE + MEM_PAGE_SIZE / 128) {
+		printf("  %s: encoded to %u bytes.\n",what,len);
+		return false;
+	}
+
+	memcpy(page,ram,MEM_PAGE_SIZE);
+	rewind_applypage(out,len,page);
+	if (memcmp(page,shadow,MEM_PAGE_SIZE)) {
+		printf("  %s: did not decode back.\n",what);
+		return false;
+	}
+
+	return true;
+}
+
+bool test_rewind() {
+
+	byte shadow[MEM_PAGE_SIZE];
+	byte ram[MEM_PAGE_SIZE];
+	bool ok = true;
+	int i;
+
+	for (i = 0; i < MEM_PAGE_SIZE; i++) {
+		shadow[i] 	= i;
+		ram[i] 		= (i & 1) ? i : ~i;
+	}
+	ok &= test_rewindpage("alternating",ram,shadow);
+
+	for (i = 0; i < MEM_PAGE_SIZE; i++) {
+		ram[i] = (i % 3) ? i : ~i;
+	}
+	ok &= test_rewindpage("every third",ram,shadow);
+
+	for (i = 0; i < MEM_PAGE_SIZE; i++) {
+		ram[i] = ~i;
+	}
+	ok &= test_rewindpage("all changed",ram,shadow);
+
+	memcpy(ram,shadow,MEM_PAGE_SIZE);
+	ok &= test_rewindpage("unchanged",ram,shadow);
+
+	return ok;
+}
+
+TEST g_tests[] = {
+
+	{"rewind",		test_rewind},
+};
+
+int main(int argc, char**argv) {
+
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < sizeof(g_tests) / sizeof(TEST); i++) {
+
+		if (argc > 1 && strcmp(argv[1],g_tests[i].name)) {
+			continue;
+		}
+
+		if (g_tests[i].fn()) {
+			printf("%-12s ok\n",g_tests[i].name);
+		} else {
+			printf("%-12s FAILED\n",g_tests[i].name);
+			failed++;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
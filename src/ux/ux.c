@@ -42,6 +42,11 @@ KNOWN BUGS:
 #include "c64kbd.h"
 #include "joystick.h"
 #include "d64.h"
+#include "mem.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "perf.h"
+#include "fileload.h"
 
 
 
@@ -63,6 +68,7 @@ typedef struct {
 
 
 #define DISLINESCOUNT 16
+#define PERF_LINE_LENGTH 128
 
 
 typedef struct {
@@ -109,6 +115,16 @@ typedef struct {
 	char        	nameString;
 
 	bool 			deferredinit;
+	bool 			deferredwait;		// disk still reading the program ahead.
+	unsigned int 	deferredframe;
+
+	//
+	// subsystem accounting shown in the monitor, worked out from the change since the last
+	// refresh about once a second.
+	//
+	PERF 			perfLast;
+	unsigned int 	perfFrames;
+	char 			perfLines[2][PERF_LINE_LENGTH];
 	
 } UX;
 
@@ -222,6 +238,24 @@ void ux_handlecommand() {
 	} else if (!strcmp(p,"KEY")) {
 		g_ux.joyon 	= false;
 
+	} else if (!strcmp(p,"SAVESTATE")) {
+		p = strtok(NULL," ");
+		snapshot_save(p ? p : SNAPSHOT_DEFAULT_PATH);
+	} else if (!strcmp(p,"LOADSTATE")) {
+		p = strtok(NULL," ");
+		if (snapshot_load(p ? p : SNAPSHOT_DEFAULT_PATH)) {
+			rewind_reset();
+			ux_fillDisassembly(cpu_getpc());
+		}
+	} else if (!strcmp(p,"BACK")) {
+		//
+		// step back through the rewind buffer, one record at a time by default.
+		//
+		p = strtok(NULL," ");
+		address = p ? strtoul(p,NULL,10) : 1;
+		while (address-- && rewind_back());
+		ux_fillDisassembly(cpu_getpc());
+		g_ux.running = false;
 	}
 
 }
@@ -430,18 +464,39 @@ void ux_deferredinit() {
 
 	EMU_CONFIGURATION *cfg = emu_getconfig();
 	D64_FILE f;
+	bool opened;
 	word loc;
 	
-	DEBUG_PRINT("** Deferred Initialization...\n");
-	fflush(g_debug);
-	if (cfg->binload != NULL) {
-		asm_loadfile(cfg->binload);
+	if (!g_ux.deferredwait) {
+		DEBUG_PRINT("** Deferred Initialization...\n");
+		fflush(g_debug);
+		if (cfg->binload != NULL) {
+			asm_loadfile(cfg->binload);
+		}
+		if (cfg->disk != NULL) {
+			d64_insert_disk(cfg->disk);
+		}
 	}
+
+	//
+	// the disk may still be reading ahead on the host. try again next frame.
+	//
+	g_ux.deferredwait = cfg->disk && cfg->program && !d64_file_ready(cfg->program);
+	if (g_ux.deferredwait) {
+		g_ux.deferredframe = vicii_getframes();
+		return;
+	}
+
 	if (cfg->disk != NULL) {
-		d64_insert_disk(cfg->disk);
 		if (cfg->program) {
-			if (d64_open_file(&f,cfg->program)) {
-				DEBUG_PRINT("Opened %s with size %d.\n",cfg->program,f.size);
+			opened = d64_open_file(&f,cfg->program);
+			if (opened && f.size < PRG_MIN_SIZE) {
+				DEBUG_PRINT("File %s is too short to load.\n",cfg->program);
+				fflush(g_debug);
+				d64_close_file(&f);
+			}
+			else if (opened) {
+				DEBUG_PRINT("Opened %s with size %lu.\n",cfg->program,f.size);
 				fflush(g_debug);
 				loc = f.data[0];
 				loc |= (((word) f.data[1]) << 8);
@@ -449,10 +504,8 @@ void ux_deferredinit() {
 				fflush(g_debug);
 				DEBUG_PRINT("Loading file %s at location %04X\n",cfg->program,loc);
 				fflush(g_debug);
-				for (int i = 2; i < f.size; i++) {
-					mem_poke(loc,f.data[i]);
-					loc++;
-				}
+				mem_load_block(loc,f.data + 2,f.size - 2,MEM_TARGET_RAM);
+				d64_close_file(&f);
 			}
 			else {
 				DEBUG_PRINT("Unable to load file %s.\n",cfg->program);
@@ -481,9 +534,6 @@ void ux_init() {
 
 	ux_fillDisassembly(cpu_getpc());
 
-	if (cfg->cartload != NULL) {
-		asm_loadcart(cfg->cartload);
-	}
 
 	if (cfg->breakpoint != 0) {
 		g_ux.brk = true;
@@ -569,10 +619,51 @@ void ux_updateDisassembly() {
 
 void ux_updateConsole() {
 
-	SDL_Rect r = {0,360,MON_SCREEN_WIDTH,20};
+	SDL_Rect r = {0,MON_SCREEN_HEIGHT - 20,MON_SCREEN_WIDTH,20};
 	SDL_RenderDrawRect(g_ux.mon.renderer,&r);
-	FC_Draw(g_ux.mon.font,g_ux.mon.renderer,0,360,g_ux.buf);
+	FC_Draw(g_ux.mon.font,g_ux.mon.renderer,0,MON_SCREEN_HEIGHT - 20,g_ux.buf);
+
+}
+
+void ux_updatePerf() {
+
+	SDL_Rect r = {0,360,MON_SCREEN_WIDTH,40};
+	SDL_Color c = FC_MakeColor(102,255,51,255);
+	double rate = perf_tickspersecond();
+	double seconds;
+	double shown = 0;
+	PERF now;
+	int len;
+	int s;
+
+	perf_get(&now);
+	seconds = (now.at - g_ux.perfLast.at) / rate;
+
+	if (g_ux.perfLast.at && seconds >= 1.0) {
+
+		len = 0;
+		for (s = 0; s < PERF_SUBSYSTEMS; s++) {
+			len += snprintf(g_ux.perfLines[0] + len,PERF_LINE_LENGTH - len,"%s %.0f%%  ",perf_name(s),
+				(now.ticks[s] - g_ux.perfLast.ticks[s]) / rate * 100 / seconds);
+			shown += (now.ticks[s] - g_ux.perfLast.ticks[s]) / rate;
+		}
+
+		snprintf(g_ux.perfLines[1],PERF_LINE_LENGTH,"%.3f MHz  %.1f fps  %.0f%% elsewhere",
+			(now.cycles - g_ux.perfLast.cycles) / seconds / 1e6,
+			(vicii_getframes() - g_ux.perfFrames) / seconds,
+			(seconds - shown) * 100 / seconds);
+	}
+
+	if (!g_ux.perfLast.at || seconds >= 1.0) {
+		g_ux.perfLast 	= now;
+		g_ux.perfFrames = vicii_getframes();
+	}
 
+	SDL_RenderDrawRect(g_ux.mon.renderer,&r);
+	FC_Draw(g_ux.mon.font,g_ux.mon.renderer,0,360,"Host:");
+	FC_DrawColor(g_ux.mon.font,g_ux.mon.renderer,60,360,c,"%s",g_ux.perfLines[0]);
+	FC_Draw(g_ux.mon.font,g_ux.mon.renderer,0,380,"Emu:");
+	FC_DrawColor(g_ux.mon.font,g_ux.mon.renderer,60,380,c,"%s",g_ux.perfLines[1]);
 }
 
 void ux_updateScreen() {
@@ -655,6 +746,7 @@ void ux_updateMonitorWindow() {
 		ux_updateRegisters();
 		ux_updateMemory();
 		ux_updateDisassembly();
+		ux_updatePerf();
 		ux_updateConsole();
 		SDL_RenderPresent(g_ux.mon.renderer);
 	}
@@ -694,11 +786,12 @@ void ux_handleevents() {
 
 void ux_update() {
 
-	
+	uint64_t present;
 
 	if (ux_running()) {
 		
-		if (g_ux.deferredinit && cpu_getpc() == 0xA480) { // basic warm start. 
+		if (g_ux.deferredinit && (g_ux.deferredwait ? g_ux.deferredframe != vicii_getframes() :
+			cpu_getpc() == 0xA480)) { // basic warm start. 
 			ux_deferredinit();
 		}
 
@@ -711,19 +804,21 @@ void ux_update() {
 
 		if (vicii_frameready()) {
 			ux_handleevents();
-				ux_updateScreenWindow();
-			
-			
+			present = perf_now();
+			ux_updateScreenWindow();
+			perf_charge(PERF_UX,perf_now() - present);
 		}
 	}
 
 	if (g_ux.cycles++ % 1000 == 0) {
 
+		present = perf_now();
 		if (!ux_running()) {
 			ux_updateScreenWindow();
 			
 		}
 		ux_updateMonitorWindow();
+		perf_charge(PERF_UX,perf_now() - present);
 		ux_handleevents();
 
 		//
@@ -921,6 +1016,17 @@ void ux_handleMetaCommands(SDL_Event e) {
 		}
 	}
 
+	//
+	// F9 saves the machine state, F10 loads it back.
+	//
+	if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F9) {
+		snapshot_save(SNAPSHOT_DEFAULT_PATH);
+	}
+	if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F10 && snapshot_load(SNAPSHOT_DEFAULT_PATH)) {
+		rewind_reset();
+		ux_fillDisassembly(cpu_getpc());
+	}
+
 	//
 	// BUGBUG: Hack to toggle joystick and keyboard mode.
 	//
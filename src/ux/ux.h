@@ -42,7 +42,7 @@ KNOWN BUGS:
 
 
 #define MON_SCREEN_WIDTH 	800
-#define MON_SCREEN_HEIGHT 	380
+#define MON_SCREEN_HEIGHT 	420
 
 
 void ux_init();